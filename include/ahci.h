@@ -19,6 +19,25 @@
 #define FIS_TYPE_REG_H2D      0x27
 #define ATA_CMD_READ_DMA_EX   0x25
 #define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_WRITE_DMA_FUA_EXT 0x3D
+#define ATA_CMD_READ_FPDMA    0x60 // READ FPDMA QUEUED
+#define ATA_CMD_WRITE_FPDMA   0x61 // WRITE FPDMA QUEUED
+#define ATA_CMD_IDENTIFY      0xEC
+#define ATA_CMD_FLUSH_CACHE   0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+#define ATA_CMD_SET_FEATURES  0xEF
+#define ATA_FEATURE_WCACHE_ON 0x02 // SET FEATURES: enable volatile write cache
+#define ATA_DEV_FUA           0x80 // device register: FPDMA write is FUA
+
+// ahci_command() flags
+#define AHCI_CMD_WRITE 0x1 // data goes to the device
+#define AHCI_CMD_FUA   0x2 // on the media before the command completes
+
+#define AHCI_CMD_SLOTS 32   // command slots per port
+#define AHCI_CMD_TBL_SIZE 4096 // bytes per command table
+#define AHCI_PRDT_MAX  ((AHCI_CMD_TBL_SIZE - 0x80) / 16) // PRDT entries per command table
+#define AHCI_PRD_MAXBYTES (4 * 1024 * 1024) // bytes one PRDT entry can move
+#define AHCI_CAP_SNCQ  (1 << 30) // HBA supports native command queuing
 
 #define HBA_PORT_IPM_ACTIVE  0x1
 #define HBA_PORT_DET_PRESENT 0x3
@@ -31,6 +50,8 @@
 #define ATA_DEV_DRQ  0x08
 
 #define AHCI_GHC_OFFSET 0x4
+#define AHCI_GHC_IE     0x2 // global interrupt enable
+#define AHCI_INTR_OFFSET 0x3C // PCI interrupt line
 #define AHCI_GHC_MASK(val)  (val >> 31)
 
 #define AHCI_VENDOR_OFFSET 0x0
@@ -191,6 +212,14 @@ typedef volatile struct tagHBA_MEM
 } HBA_MEM;
 //END
 
+// One piece of a scatter-gather transfer: len bytes of physically
+// contiguous memory at addr. Both must be even, and the pieces of
+// one request must add up to whole sectors.
+struct sata_sg {
+	uint8 *addr;
+	uint32 len;
+};
+
 uint16 ahci_probe(uint16 bus, uint16 slot, uint16 func, uint16 offset);
 uint64 ahci_read(uint16 bus, uint16 slot, uint16 func, uint16 offset);
 void   ahci_write8(ushort bus, ushort slot,ushort func, ushort offset, uint8 data);
@@ -202,6 +231,12 @@ int    ahci_sata_write(HBA_PORT *port, uint32 startl, uint32 starth, uint32 coun
 uint32 sata_device_count();
 int    sata_read(uint32 dev, uint64 lba, uint32 count, uint8 *buf);
 int    sata_write(uint32 dev, uint64 lba, uint32 count, uint8 *buf);
+int    ahci_sata_readv(HBA_PORT *port, uint32 startl, uint32 starth, struct sata_sg *sg, int nsg);
+int    ahci_sata_writev(HBA_PORT *port, uint32 startl, uint32 starth, struct sata_sg *sg, int nsg, int fua);
+int    ahci_sata_flush(HBA_PORT *port);
+int    sata_readv(uint32 dev, uint64 lba, struct sata_sg *sg, int nsg);
+int    sata_writev(uint32 dev, uint64 lba, struct sata_sg *sg, int nsg, int fua);
+int    sata_flush(uint32 dev);
 void   ahci_sata_init(HBA_PORT *port, int num);
 
 int8   ahci_rebase_port(HBA_PORT *port, int num);
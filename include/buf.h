@@ -1,17 +1,32 @@
 #define SECTOR_SIZE 512
+#define BLOCK_MAX_SIZE 4096 // largest block a buffer holds
+
+#include "sleeplock.h"
 
 struct buf {
   int32 flags;
   uint32 dev;
-  uint32 sector;
+  uint32 sector;     // first sector of the block
+  uint32 size;       // block size in bytes, a multiple of SECTOR_SIZE
+  struct sleeplock lock; // held by the process using the buffer
+  uint refcnt;           // processes using or waiting for it
   struct buf *prev; // LRU cache list
   struct buf *next;
+  uint8 inlru;      // on the LRU list?
+  struct buf *hnext; // hash chain
+  struct buf *hprev;
   struct buf *qnext; // disk queue
-  uint8 data[SECTOR_SIZE];
+  struct buf *mnext; // next buffer merged into the same request
+  uint qtime;        // ticks when queued
+  uint8 *data;       // a page, allocated with the buffer
 };
-#define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_QUEUED 0x8    // waiting in a block request queue
+#define B_INFLIGHT 0x10 // I/O submitted and not yet complete
+#define B_ASYNC 0x20    // nobody waits; release when the I/O completes
+#define B_FUA 0x40      // write through the drive's cache to the media
+#define B_FLUSH 0x80    // no data: flush the drive's write cache (ide.c)
 
 #define DEV_TYPE_MASK 0xF0000000
 #define DEV_NUM_MASK  0x0FFFFFFF
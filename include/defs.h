@@ -2,18 +2,43 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct pcounter;
 struct pipe;
 struct proc;
+struct readahead;
+struct rwsem;
+struct sata_sg;
+struct sleeplock;
 struct spinlock;
 struct stat;
 struct superblock;
+struct trapframe;
+struct vdso_data;
 
 // bio.c
 void            binit(void);
+void            bsizeinit(void);
+int             bshrink(int);
 struct buf*     bread(uint, uint);
+struct buf*     breadn(uint, uint, uint);
+struct buf*     bgetblk(uint, uint);
+int             bbypass(uint, uint, int);
+void            breada(uint, uint);
 void            brelse(struct buf*);
+void            brelseasync(struct buf*);
 void            bwrite(struct buf*);
 
+// blk.c
+void            blkinit(void);
+void            kblockdinit(void);
+void            blksubmit(struct buf*);
+void            blkflush(uint);
+int             blkdma(uint);
+void            blkdirect(uint, uint, struct sata_sg*, int, int);
+void            blkwait(struct buf*);
+void            blkplug(uint);
+void            blkunplug(uint);
+
 // console.c
 void            consoleinit(void);
 void            cprintf(char*, ...);
@@ -42,6 +67,7 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            vfsinit(void);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -50,13 +76,18 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            readahead(struct inode*, struct readahead*, uint, uint);
+int             readdirect(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             writedirect(struct inode*, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            ideflush(uint);
+void            idepciattach(uint32);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -69,6 +100,7 @@ char*           kmalloc(uint16 pages);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+uint            kfreepages(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -79,6 +111,8 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicsettimer(int, uint);
+void            lapicipi(uchar, int);
 void            microdelay(int);
 
 // log.c
@@ -86,6 +120,9 @@ void            initlog(void);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+uint            logseq(void);
+void            logforce(uint);
+void            logsync(void);
 
 // mp.c
 extern int      ismp;
@@ -101,6 +138,11 @@ int             acpiinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// percpu.c
+void            percpuinit(void);
+void            pcounteradd(struct pcounter*, int64);
+int64           pcountersum(struct pcounter*);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -123,6 +165,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+struct proc*    kthread(char*, void (*)(void*), void*);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
@@ -130,10 +173,31 @@ enum procstate  pstate(int);
 int             pname(int, char*, int);
 int             getpriority(int);
 int             setpriority(int, int);
+int             getscheduler(int);
+int             setscheduler(int, int, int);
+int             schedtick(void);
+void            cpuidle(void);
+int             sleepticks(uint);
+int             sleeptimeout(void*, struct spinlock*, uint);
+void            twadvance(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// sleeplock.c
+void            initsleeplock(struct sleeplock*, char*);
+void            acquiresleep(struct sleeplock*);
+void            releasesleep(struct sleeplock*);
+int             holdingsleep(struct sleeplock*);
+void            initrwsem(struct rwsem*, char*);
+void            downread(struct rwsem*);
+void            upread(struct rwsem*);
+void            downwrite(struct rwsem*);
+void            upwrite(struct rwsem*);
+void            uprw(struct rwsem*);
+int             holdingwrite(struct rwsem*);
+int             rwsemlocked(struct rwsem*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 uint8           sacquire(struct spinlock*, uint32 waitticks);
@@ -141,6 +205,8 @@ void            getcallerpcs(void*, uintp*);
 void            getstackpcs(uintp*, uintp*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            destroylock(struct spinlock*);
+void            lockstatinit(void);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -154,9 +220,17 @@ int             arguintp(int, uintp*);
 int             fetchuintp(uintp, uintp*);
 int             fetchstr(uintp, char**);
 void            syscall(void);
+void            syscalltrap(struct trapframe*);
+void            scstatinit(void);
 
 // timer.c
 void            timerinit(void);
+void            pitdelaystart(uint);
+void            pitdelaywait(void);
+void            tscinit(uint64);
+uint64          tscfreq(void);
+uint64          nsecs(void);
+void            tscvdso(struct vdso_data*);
 
 // trap.c
 void            trapinit(void);
@@ -191,6 +265,8 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             mapvdso(pde_t*, struct proc*);
+extern struct vdso_data* vdsodata;
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
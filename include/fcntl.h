@@ -4,6 +4,7 @@
 #define O_WRONLY   _BIT(2)
 #define O_RDWR     _BIT(3)
 #define O_CREATE   _BIT(4)
+#define O_DIRECT   _BIT(5)  // move whole blocks between disk and user memory
 
 #define F_ERROR    (-1)
 #define FNOT_READY (-2)
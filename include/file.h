@@ -1,3 +1,12 @@
+#include "sleeplock.h"
+
+// Sequential readahead state of an open file.
+struct readahead {
+  uint next;   // offset at which a sequential read would continue
+  uint win;    // window in blocks; 0 until reads look sequential
+  uint ahead;  // first block not yet read ahead
+};
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE } type;
   int ref; // reference count
@@ -6,6 +15,8 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  char direct;  // O_DIRECT
+  struct readahead ra;
 };
 
 
@@ -14,7 +25,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  int flags;          // I_BUSY, I_VALID
+  int flags;          // I_VALID
+  struct rwsem lock;  // held shared to read, exclusively to change
 
   short type;         // copy of disk inode
   short major;
@@ -22,14 +34,17 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[/*NDIRECT+1*/29]; // TODO: make this not specific to fs1
+  uint lsn;           // log transaction holding the last change
+  uint dwrites;       // writes that went around the log, like O_DIRECT
+  uint dflushed;      // dwrites when fsync last flushed the drive cache
 };
-#define I_BUSY 0x1
 #define I_VALID 0x2
 
 // table mapping major device number to
-// device functions
+// device functions. read gets the file offset; devices that
+// aren't seekable ignore it.
 struct devsw {
-  int (*read)(struct inode*, char*, int);
+  int (*read)(struct inode*, char*, uint, int);
   int (*write)(struct inode*, char*, int);
 };
 
@@ -38,6 +53,8 @@ extern struct devsw devsw[];
 #define TTY0    1
 #define TTY1    2
 #define LOOP0   3
+#define SCSTAT  4
+#define LOCKSTAT 5
 
 struct pollfd {
     int   fd;         /* file descriptor */
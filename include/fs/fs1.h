@@ -28,8 +28,11 @@ void            fs1_readinode(struct inode *);
 void            fs1_iupdate(struct inode*);
 int             fs1_namecmp(const char*, const char*);
 int             fs1_readi(struct inode*, char*, uint, uint);
+void            fs1_readahead(struct inode*, struct readahead*, uint, uint);
+int             fs1_readdirect(struct inode*, char*, uint, uint);
 void            fs1_stati(struct inode*, struct stat*);
 int             fs1_writei(struct inode*, char*, uint, uint);
+int             fs1_writedirect(struct inode*, char*, uint, uint);
 void            fs1_itrunc(struct inode* ip);
 
 #define NDIRECT 28
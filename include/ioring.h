@@ -0,0 +1,41 @@
+// Submission/completion ring for batching file and pipe operations.
+// The ring lives in user memory: user space fills sq[] and advances
+// sqtail, then ioring_enter() runs every queued entry in one trap and
+// posts a completion for each to cq[]. Indices are free-running and
+// masked with IORING_ENTRIES-1.
+#define IORING_ENTRIES 64  // must be a power of 2
+
+// Operations
+#define IORING_OP_NOP   0
+#define IORING_OP_READ  1  // read(fd, addr, len)
+#define IORING_OP_WRITE 2  // write(fd, addr, len)
+#define IORING_OP_OPEN  3  // open((char*)addr, len), len is the mode
+#define IORING_OP_CLOSE 4  // close(fd)
+#define IORING_OP_SEEK  5  // seek(fd, len)
+
+// Entry flags
+#define IORING_F_LINK   1  // skip the next entry if this one fails
+
+struct io_sqe {
+  uint8 op;
+  uint8 flags;
+  uint16 pad;
+  int fd;
+  uint64 addr;
+  int len;
+  uint64 udata;  // handed back untouched in the completion
+};
+
+struct io_cqe {
+  uint64 udata;
+  int res;       // what the equivalent system call would return
+};
+
+struct ioring {
+  volatile uint sqhead;  // advanced by the kernel
+  volatile uint sqtail;  // advanced by user space
+  volatile uint cqhead;  // advanced by user space
+  volatile uint cqtail;  // advanced by the kernel
+  struct io_sqe sq[IORING_ENTRIES];
+  struct io_cqe cq[IORING_ENTRIES];
+};
@@ -9,6 +9,7 @@
 #define IRQ_IDE1        14
 #define IRQ_IDE2        15
 #define IRQ_ERROR       19
+#define IRQ_RESCHED     30      // IPI: a process became runnable
 #define IRQ_SPURIOUS    31
 #define MAX_IRQS        32
 
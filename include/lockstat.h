@@ -0,0 +1,16 @@
+// Spinlock contention statistics, read from the LOCKSTAT device as
+// one struct lockstat per registered lock. Times are in TSC cycles.
+// pcs[] is the call stack of the lock's latest contended acquire.
+// Reads go on from the file offset, so read until end of file to
+// see every lock.
+#define LOCKSTAT_NPCS 4
+
+struct lockstat {
+  char name[16];
+  uint64 acquired;    // acquisitions
+  uint64 contended;   // acquisitions that had to wait
+  uint64 spincycles;  // total cycles spent waiting
+  uint64 maxspin;     // longest wait
+  uint64 holdcycles;  // total cycles the lock was held
+  uint64 pcs[LOCKSTAT_NPCS];
+};
@@ -39,13 +39,30 @@
 
 #define CR4_PSE         0x00000010      // Page size extension
 
+// SYSRET loads the user SS and CS from the two descriptors
+// following STAR[63:48], so SEG_UDATA must directly precede SEG_UCODE.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
 #define SEG_KCPU  3  // kernel per-cpu data
-#define SEG_UCODE 4  // user code
-#define SEG_UDATA 5  // user data+stack
+#define SEG_UDATA 4  // user data+stack
+#define SEG_UCODE 5  // user code
 #define SEG_TSS   6  // this process's task state
 
+// Layout of each CPU's local storage page (see seginit).
+// %fs points at CPULOCAL_FS; thread-local variables sit just below it.
+#define CPULOCAL_GDT      0
+#define CPULOCAL_TSS      1024
+#define CPULOCAL_USERRSP  1536  // user %rsp saved by syscallentry
+#define CPULOCAL_FS       2048
+
+// Model specific registers
+#define MSR_EFER   0xC0000080
+#define MSR_STAR   0xC0000081   // SYSCALL/SYSRET segment selectors
+#define MSR_LSTAR  0xC0000082   // SYSCALL entry point
+#define MSR_FMASK  0xC0000084   // rflags bits cleared by SYSCALL
+#define MSR_FSBASE 0xC0000100
+#define EFER_SCE   0x00000001   // SYSCALL enable
+
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
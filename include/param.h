@@ -1,11 +1,28 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU        128  // maximum number of CPUs
+#define HZ          100  // timer interrupts per second
+#define NOHZ_MAX_TICKS 10  // longest a tickless CPU goes without a timer interrupt
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data sectors in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  32  // max # of blocks any FS op writes
+#define LOGSIZE     120  // max data sectors in on-disk log; the header holds 126
+#define LOG_FLUSH_AGE (5*HZ)  // ticks a commit may wait to be written home
+#define LOG_DIRTY_RATIO 50   // percent of the log committed that triggers a checkpoint
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHE_MAXFRAC  4  // block cache grows to 1/4 of free memory at boot
+#define BCACHE_LOWFRAC 16  // and stops growing below 1/16 of it free
+#define BLK_MAXSECTORS 128 // most sectors merged into one request
+#define BLK_MAXBUFS  32    // most buffers merged into one request
+#define BLK_READ_DEADLINE  50  // ticks a read may wait for the elevator
+#define BLK_WRITE_DEADLINE 500 // ticks a write may wait for the elevator
+#define RA_MINBLOCKS 4     // first readahead window of a sequential reader
+#define RA_MAXBLOCKS 32    // largest readahead window
+#define KALLOC_RECLAIM 64  // buffers kalloc() reclaims when out of memory
+#define LOCK_STATS    0  // collect contention statistics for every spinlock (costs every acquire)
+#define NLOCKSTAT   256  // most contended spinlocks the lockstat tool keeps
+#define LOCKSTAT_BATCH 8 // locks the lockstat device reads per hold of its list
+#define CACHELINE    64  // bytes per cache line
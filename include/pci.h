@@ -33,6 +33,7 @@ struct pci_bus {
 #define PCI_DEV_CLASS_BRIDGE        0x6
 
 #define	PCI_SUBCLASS_BRIDGE_PCI 0x04
+#define	PCI_SUBCLASS_STORAGE_IDE 0x01
 
 #define PCI_BAR0_OFFSET   0x10
 #define PCI_BAR1_OFFSET   0x14
@@ -0,0 +1,31 @@
+// Per-CPU variables.
+//
+// DEFINE_PERCPU(type, name) places name in the .percpu section. That
+// section is only a template: percpuinit() gives every CPU its own
+// copy of it, cache-line aligned, and stores the address of the copy
+// in the thread-local percpubase, so THISCPU() reaches the running
+// CPU's copy through %fs. Code touching its own CPU's copy must not
+// migrate meanwhile: hold pushcli() or a spinlock.
+#define DEFINE_PERCPU(type, name) \
+	__attribute__((section(".percpu"))) type name
+#define DECLARE_PERCPU(type, name) \
+	extern __attribute__((section(".percpu"))) type name
+
+extern char percpu_start[], percpu_end[];
+extern __thread char *percpubase;
+extern char *percpuarea[NCPU];
+
+// Pointer to the running CPU's copy of var.
+#define THISCPU(var) \
+	((typeof(var)*)(percpubase + ((char*)&(var) - percpu_start)))
+// Pointer to CPU c's copy of var.
+#define PERCPU(var, c) \
+	((typeof(var)*)(percpuarea[c] + ((char*)&(var) - percpu_start)))
+
+// Counter that CPUs add to without locks or shared cache lines:
+// each adds to its own copy, pcountersum() adds the copies up.
+struct pcounter {
+  int64 count;
+};
+
+#define DEFINE_PCOUNTER(name) DEFINE_PERCPU(struct pcounter, name)
@@ -3,7 +3,8 @@
 #define PROC_BLESSED 1
 #define PROC_DAMNED  0
 
-// Per-CPU state
+// Per-CPU state, one cache line aligned entry per CPU so that
+// CPUs don't write to each other's lines.
 struct cpu {
   uchar id;                    // index into cpus[] below
   uchar apicid;                // Local APIC ID
@@ -14,11 +15,15 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   uint64 capabilities;         // bitmask of capabilities of this CPU
+  uint rtperiod;               // ticks at start of the current RT throttling window
+  uint rtused;                 // ticks consumed by RT tasks in the current window
+  volatile uint idle;          // halted in cpuidle(), kick with IRQ_RESCHED
+  uint8 tickmode;              // TICK_PERIODIC, TICK_ONESHOT or TICK_STOPPED
 
   // Cpu-local storage variables; see below
   void *local;
   struct proc *proc;
-};
+} __attribute__((aligned(CACHELINE)));
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
@@ -26,10 +31,33 @@ extern int ncpu;
 #define CPU_RESERVED_BLESS 0x01
 #define CPU_DISABLED       0x02
 
+// LAPIC timer modes, see lapicsettimer(). A CPU with nothing to run
+// stops its tick; one running a single task only keeps a one-shot
+// safety net. The boot CPU keeps time and never stops entirely.
+#define TICK_PERIODIC 0
+#define TICK_ONESHOT  1
+#define TICK_STOPPED  2
+
 #define PROC_NO_BOOST_PRIORITY 0x0A
 #define PROC_DEFAULT_PRIORITY  0x80
 #define PROC_MAX_PRIORITY      0xFF
 
+// Scheduling classes. SCHED_FIFO and SCHED_RR tasks always run ahead of
+// SCHED_NORMAL tasks; among themselves the highest rtpriority wins and
+// ties are broken by how long a task has been waiting. FIFO tasks keep
+// their place until they block, RR tasks rotate every SCHED_RR_TIMESLICE.
+#define SCHED_NORMAL 0
+#define SCHED_FIFO   1
+#define SCHED_RR     2
+
+#define SCHED_RT_MAX_PRIORITY 99
+#define SCHED_RR_TIMESLICE    10   // ticks an RR task runs before rotating
+
+// RT throttling: within every SCHED_RT_PERIOD ticks, RT tasks may use at
+// most SCHED_RT_RUNTIME ticks of a CPU, leaving the rest to normal tasks.
+#define SCHED_RT_PERIOD  100
+#define SCHED_RT_RUNTIME  95
+
 // Per-CPU variables, holding pointers to the
 // current cpu and to the current process.
 // The asm suffix tells gcc to use "%gs:0" to refer to cpu
@@ -93,6 +121,16 @@ struct proc {
   uint8 blessed;
   uint8 priority;
   uint32 skipped;
+  uint8 policy;                // SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+  uint8 rtpriority;            // 1..SCHED_RT_MAX_PRIORITY for RT policies
+  uint32 rtslice;              // ticks left in the current RR timeslice
+  uint rtqueued;               // ticks when this RT task was last queued
+  uint wakeat;                 // ticks at which a timed sleep expires
+  struct proc *tnext;          // next process in the same timer wheel slot
+  struct proc **tpprev;        // link pointing at us, 0 if not on the wheel
+  struct vdso_proc *vdsoproc;  // this process's vDSO page
+  void (*kfn)(void*);          // kernel thread body, 0 for user processes
+  void *karg;
 
   // rpipe & wpipe are only used by blessed processes
   // both are named from the perspective of the kernel
@@ -0,0 +1,12 @@
+// System call statistics, read from the SCSTAT device as an array of
+// SCSTAT_NSYS struct scstat indexed by system call number, summed over
+// all CPUs. Latencies are in TSC cycles; histogram bucket i counts the
+// calls that took [2^i, 2^(i+1)) cycles, the last bucket everything longer.
+#define SCSTAT_NSYS    64
+#define SCSTAT_BUCKETS 32
+
+struct scstat {
+  uint64 count;                 // calls made
+  uint64 cycles;                // total cycles spent in the call
+  uint hist[SCSTAT_BUCKETS];    // log2 latency histogram
+};
@@ -0,0 +1,30 @@
+#ifndef XV64_SLEEPLOCK
+#define XV64_SLEEPLOCK
+
+#include "spinlock.h"
+
+// Long-term lock for processes. Waiters sleep instead of spinning,
+// so it may be held across disk I/O.
+struct sleeplock {
+  uint locked;        // Is the lock held?
+  struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding the lock, 0 before the first process
+  int pid;            // and its pid, for debugging
+
+  char *name;         // Name of lock.
+};
+
+// Reader-writer semaphore: any number of readers or one writer.
+// Once a writer is waiting, new readers queue behind it so that
+// a stream of readers cannot starve it.
+struct rwsem {
+  int readers;        // Processes holding it shared
+  uint writing;       // Held exclusively?
+  int wwait;          // Writers waiting
+  struct spinlock lk; // spinlock protecting this semaphore
+  struct proc *owner; // Writer holding it, for debugging and holdingwrite()
+
+  char *name;         // Name of lock.
+};
+
+#endif
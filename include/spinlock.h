@@ -1,6 +1,17 @@
-// Mutual exclusion lock.
+#ifndef XV64_SPINLOCK
+#define XV64_SPINLOCK
+
+// Mutual exclusion lock. A ticket lock: acquirers take the next
+// ticket and wait until owner reaches it, so waiters are served in
+// arrival order. The lock is held while owner != next.
 struct spinlock {
-  uint locked;        // Is the lock held?
+  union {
+    volatile uint ticket;     // both halves, for atomic updates
+    struct {
+      volatile uint16 owner;  // ticket now being served
+      volatile uint16 next;   // next ticket to hand out
+    };
+  };
   unsigned short sig; // Used by spinlock/holding to differentiate empty ram
                       // from an unacquired lock on CPU#0
 
@@ -9,8 +20,21 @@ struct spinlock {
   struct cpu *cpu;   // The cpu holding the lock.
   uintp pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+
+  // Contention statistics, kept when LOCK_STATS is set; see lockstat.h.
+  uint64 acquired;
+  uint64 contended;
+  uint64 spincycles;
+  uint64 maxspin;
+  uint64 holdcycles;
+  uint64 acqtsc;      // when the current holder got the lock
+  uintp cpcs[4];      // call stack of the latest contended acquire
+  struct spinlock *statnext, *statprev; // every initialized lock
 };
 
 #define SPINLOCK_SIG 0xAD16
+#define SPINLOCK_TICKET (1 << 16) // adds one to next in ticket
 #define SPINLOCK_ACQUIRED 1
 #define SPINLOCK_NOT_ACQUIRED 0
+
+#endif
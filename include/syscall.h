@@ -38,3 +38,10 @@
 #define SYS_cpuhalt       37
 #define SYS_getpriority   38
 #define SYS_setpriority   39
+#define SYS_getscheduler  40
+#define SYS_setscheduler  41
+#define SYS_clock_gettime 42
+#define SYS_nanosleep     43
+#define SYS_ioring_enter  44
+#define SYS_sync          45
+#define SYS_fsync         46
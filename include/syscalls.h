@@ -1,4 +1,6 @@
 struct stat;
+struct timespec;
+struct ioring;
 
 // system calls
 int fork(void);
@@ -39,3 +41,10 @@ int nprocs(void);
 void cpuhalt(void);
 int getpriority(int);
 int setpriority(int, int);
+int getscheduler(int);
+int setscheduler(int, int, int);
+int clock_gettime(int, struct timespec*);
+int nanosleep(struct timespec*, struct timespec*);
+int ioring_enter(struct ioring*, int);
+int sync(void);
+int fsync(int);
@@ -0,0 +1,10 @@
+#define NSEC_PER_SEC  1000000000L
+#define NSEC_PER_TICK (NSEC_PER_SEC / HZ)
+
+// Clock ids for clock_gettime()
+#define CLOCK_MONOTONIC 1  // nanoseconds since boot, never goes backwards
+
+struct timespec {
+  int64 tv_sec;   // seconds
+  int64 tv_nsec;  // nanoseconds, 0..NSEC_PER_SEC-1
+};
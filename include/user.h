@@ -1,10 +1,16 @@
 #include "syscalls.h"
 
+struct io_cqe;
+
 // ulib.c
 #define TIOCGWINSZ 0x100
 int   stat(char*, struct stat*);
 char* gets(char *buf, int max);
 int32 ioctl(int32 fd, uint64 cmd, ...);
+void  ioring_init(struct ioring*);
+int   ioring_prep(struct ioring*, int, int, void*, int, uint64);
+int   ioring_submit(struct ioring*);
+int   ioring_reap(struct ioring*, struct io_cqe*);
 
 
 // printf.c
@@ -0,0 +1,22 @@
+// The vDSO: read-only pages the kernel maps into every process at
+// VDSO_BASE, so ulib can answer ticks(), getpid(), nprocs(), info()
+// and clock_gettime() without a system call. VDSO_BASE sits just
+// above the highest address user memory can grow to.
+#define VDSO_BASE 0x3FA00000
+#define VDSO_PROC (VDSO_BASE + 0x1000)
+
+// Shared by all processes. Written by the kernel only.
+struct vdso_data {
+  volatile uint ticks;   // timer ticks since boot
+  uint hz;               // ticks per second
+  uint ncpu;             // number of CPUs
+  uint64 tschz;          // TSC cycles per second, 0 if uncalibrated
+  uint64 tscmult;        // ns = ((tsc - tscboot) * tscmult) >> 32
+  uint64 tscboot;
+  char info[64];         // kernel description, as returned by info()
+};
+
+// One per process.
+struct vdso_proc {
+  int pid;
+};
@@ -15,6 +15,13 @@ static inline void amd64_nop(){
 
 #define amd64_pause() asm volatile ("pause")
 
+static inline unsigned long amd64_rdtsc(void){
+	unsigned int lo, hi;
+
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long)hi << 32) | lo;
+}
+
 #define amd64_mem_barrier() asm volatile ("lock; addl $0,0(%%rsp)" : : : "memory")
 
 #define amd64_mem_read32(addr) (*(volatile unsigned int *)(addr))
@@ -176,6 +183,12 @@ static inline void amd64_hlt(void) {
 	asm volatile ("hlt");
 }
 
+// Enable interrupts and halt. sti only takes effect after the next
+// instruction, so an interrupt can't slip in between the two.
+static inline void amd64_sti_hlt(void) {
+	asm volatile ("sti; hlt");
+}
+
 static inline unsigned int amd64_xchg(volatile unsigned int *addr, unsigned long newval) {
 	unsigned int result;
 
@@ -187,6 +200,38 @@ static inline unsigned int amd64_xchg(volatile unsigned int *addr, unsigned long
 	return result;
 }
 
+// Atomically add val to *addr and return the old value.
+static inline unsigned int amd64_xadd(volatile unsigned int *addr, unsigned int val) {
+	asm volatile ("lock; xaddl %0, %1" :
+	              "+r" (val), "+m" (*addr) :
+	              :
+	              "memory", "cc");
+	return val;
+}
+
+// Atomically replace *addr with newval if it equals oldval.
+// Returns the value *addr held before.
+static inline unsigned int amd64_cmpxchg(volatile unsigned int *addr, unsigned int oldval, unsigned int newval) {
+	unsigned int result;
+
+	asm volatile ("lock; cmpxchgl %2, %1" :
+	              "=a" (result), "+m" (*addr) :
+	              "r" (newval), "0" (oldval) :
+	              "memory", "cc");
+	return result;
+}
+
+// 64-bit amd64_cmpxchg.
+static inline unsigned long amd64_cmpxchg64(volatile unsigned long *addr, unsigned long oldval, unsigned long newval) {
+	unsigned long result;
+
+	asm volatile ("lock; cmpxchgq %2, %1" :
+	              "=a" (result), "+m" (*addr) :
+	              "r" (newval), "0" (oldval) :
+	              "memory", "cc");
+	return result;
+}
+
 static inline unsigned long rcr2(void) {
 	unsigned long val;
 	asm volatile ("mov %%cr2,%0" : "=r" (val));
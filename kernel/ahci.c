@@ -5,6 +5,11 @@
 #include "x86.h"
 #include "kernel/string.h"
 #include "memlayout.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "irq.h"
+#include "spinlock.h"
 
 //AHCI implementation.
 //See Intel reference docs @ https://www.intel.com/content/dam/www/public/us/en/documents/technical-specifications/serial-ata-ahci-spec-rev1-3-1.pdf
@@ -27,30 +32,181 @@ extern uint64 ROOT_DEV;
 static uint32 sataDeviceCount = 0;
 static HBA_PORT* BLOCK_DEVICES[AHCI_MAX_SLOT];
 
+// Command state for each disk, indexed like BLOCK_DEVICES.
+// Each caller claims a free command slot, issues its command and
+// sleeps until ahciintr() reaps the slot from PxSACT/PxCI. On drives
+// with native command queuing the commands run concurrently; other
+// drives get a single slot, so callers take turns.
+static struct ahciport {
+	HBA_MEM *hba;
+	HBA_PORT *port;
+	int num;            // port number within the HBA
+	struct spinlock lock;
+	int ncq;            // issue READ/WRITE FPDMA QUEUED
+	int nslots;         // command slots used on this port
+	int wcache;         // the drive's volatile write cache is on
+	int fua;            // the drive takes FUA writes
+	uint8 flushcmd;     // FLUSH CACHE (EXT)
+	int excl;           // a non-queued command owns the port
+	uint32 claimed;     // slots owned by a caller
+	uint32 active;      // slots issued and not yet complete
+	int status[AHCI_CMD_SLOTS]; // SATA_IO_* result of each slot
+} ahciports[AHCI_MAX_SLOT];
+static int ahciirq;     // completions arrive by interrupt
+
 #define SATA_IO_MAX_WAIT 10000
 
-static inline uint8 wait_for_sata_command(HBA_PORT *port, int32 slot) {
-	// Wait for completion
-	while (1) {
-		amd64_nop();
-		if ((port->ci & (1<<slot)) == 0) {
-			break;
-		}
-		if ((port->is & HBA_PxIS_ERR_MASK) > 0) {
-			break;
-		}
-	}
-	if ((port->is & HBA_PxIS_IFS) == HBA_PxIS_IFS) {
+// Translate a port's interrupt status into a SATA_IO_* code.
+static int ahci_status(uint32 is) {
+	if ((is & HBA_PxIS_IFS) == HBA_PxIS_IFS) {
 		return SATA_IO_ERROR_CRC_ERR;
 	}
-	if ((port->is & HBA_PxIS_HBDS) == HBA_PxIS_HBDS) {
+	if ((is & HBA_PxIS_HBDS) == HBA_PxIS_HBDS) {
 		return SATA_IO_HBA_DATA_ERR;
 	}
-	if ((port->is & HBA_PxIS_HBFS) == HBA_PxIS_HBFS) {
+	if ((is & HBA_PxIS_HBFS) == HBA_PxIS_HBFS) {
 		return SATA_IO_HBA_HOST_BUS_ERR;
 	}
 
-	return (port->is & HBA_PxIS_TFES) == HBA_PxIS_TFES ? SATA_IO_ERROR_TASK_ERR : SATA_IO_SUCCESS;
+	return (is & HBA_PxIS_TFES) == HBA_PxIS_TFES ? SATA_IO_ERROR_TASK_ERR : SATA_IO_SUCCESS;
+}
+
+static struct ahciport* ahci_portstate(HBA_PORT *port) {
+	for (uint32 i = 0; i < sataDeviceCount; i++) {
+		if (ahciports[i].port == port)
+			return &ahciports[i];
+	}
+	return 0;
+}
+
+// Claim a free command slot on port, sleeping until one is free.
+// Before the port is registered only the boot probe runs on it,
+// so any slot the HBA isn't using will do. A non-queued command
+// on a queuing drive must run alone: excl waits for the port to
+// go idle and keeps other commands out until it completes.
+static int32 ahci_claimslot(HBA_PORT *port, int excl) {
+	struct ahciport *ap = ahci_portstate(port);
+	uint32 used;
+	int32 slot;
+
+	if (ap == 0)
+		return ahci_find_cmdslot(port);
+	acquire(&ap->lock);
+	for (;;) {
+		used = ap->claimed | port->sact | port->ci;
+		for (slot = 0; slot < ap->nslots; slot++) {
+			if ((used & (1u<<slot)) == 0)
+				break;
+		}
+		if (excl && used)
+			slot = ap->nslots;
+		if (slot < ap->nslots && !ap->excl)
+			break;
+		if (proc == 0) {
+			release(&ap->lock);
+			return -1;
+		}
+		sleep(ap, &ap->lock);
+	}
+	ap->claimed |= 1u<<slot;
+	ap->excl = excl;
+	release(&ap->lock);
+	return slot;
+}
+
+static void ahci_releaseslot(HBA_PORT *port, int32 slot) {
+	struct ahciport *ap = ahci_portstate(port);
+
+	if (ap == 0)
+		return;
+	acquire(&ap->lock);
+	ap->claimed &= ~(1u<<slot);
+	ap->excl = 0;
+	wakeup(ap);
+	release(&ap->lock);
+}
+
+// Issue the command in slot and wait for it to complete.
+// Before interrupts are set up, or with no process to put
+// to sleep, poll the port as the boot probe does.
+static inline uint8 wait_for_sata_command(HBA_PORT *port, int32 slot, int ncq) {
+	struct ahciport *ap = ahci_portstate(port);
+	uint32 bit = 1u<<slot;
+	int status;
+
+	if (ap == 0 || !ahciirq || proc == 0) {
+		port->is = (uint32) -1; // Clear pending interrupt bits
+		if (ncq)
+			port->sact = bit;
+		port->ci = bit; // Issue command
+		while (1) {
+			amd64_nop();
+			if (((port->sact | port->ci) & bit) == 0) {
+				break;
+			}
+			if ((port->is & HBA_PxIS_ERR_MASK) > 0) {
+				break;
+			}
+		}
+		status = ahci_status(port->is);
+	} else {
+		acquire(&ap->lock);
+		ap->active |= bit;
+		if (ncq)
+			port->sact = bit;
+		port->ci = bit; // Issue command
+		while (ap->active & bit)
+			sleep(&ap->status[slot], &ap->lock);
+		status = ap->status[slot];
+		release(&ap->lock);
+	}
+	ahci_releaseslot(port, slot);
+	return status;
+}
+
+// Interrupt handler: reap every slot that the drive has finished,
+// as shown by its bit clearing in both PxSACT and PxCI, then
+// acknowledge the HBA. The IOAPIC line is edge-triggered, so a port
+// that raises status while we run would not interrupt again; keep
+// going until a whole pass finds every port quiet.
+static void ahciintr(uint16 irq) {
+	struct ahciport *ap;
+	uint32 is, done;
+	int status, again;
+
+	do {
+		again = 0;
+		for (uint32 i = 0; i < sataDeviceCount; i++) {
+			ap = &ahciports[i];
+			is = ap->port->is;
+			if (is == 0)
+				continue;
+			again = 1;
+			ap->port->is = is;
+			acquire(&ap->lock);
+			if (is & HBA_PxIS_ERR_MASK) {
+				// An error stops the port and aborts every
+				// queued command; restart it for later ones.
+				done = ap->active;
+				status = ahci_status(is);
+				ap->port->serr = ap->port->serr;
+				ahci_stop_port(ap->port);
+				ahci_start_port(ap->port);
+			} else {
+				done = ap->active & ~(ap->port->sact | ap->port->ci);
+				status = SATA_IO_SUCCESS;
+			}
+			for (int32 slot = 0; slot < AHCI_CMD_SLOTS; slot++) {
+				if (done & (1u<<slot)) {
+					ap->status[slot] = status;
+					wakeup(&ap->status[slot]);
+				}
+			}
+			ap->active &= ~done;
+			release(&ap->lock);
+			ap->hba->is = 1u << ap->num;
+		}
+	} while (again);
 }
 
 void ahci_try_setup_device(uint16 bus, uint16 slot, uint16 func) {
@@ -86,6 +242,8 @@ void ahci_try_setup_known_device(char *dev_name, uint64 ahci_base_mem, uint16 bu
 	}else{
 		cprintf("AHCI-only mode\n");
 	}
+	uint32 firstDevice = sataDeviceCount;
+	uint32 ncs = ((ptr->cap >> 8) & 0x1F) + 1; // command slots per port
 
 	uint64 pi = ptr->pi;
 	for(int i = 0; (i != 32); i++) {
@@ -120,6 +278,32 @@ void ahci_try_setup_known_device(char *dev_name, uint64 ahci_base_mem, uint16 bu
 			}
 		}
 	}
+	for(uint32 d = firstDevice; d < sataDeviceCount; d++) {
+		struct ahciport *ap = &ahciports[d];
+		ap->hba = ptr;
+		if(!(ptr->cap & AHCI_CAP_SNCQ)) {
+			ap->ncq = 0;
+		}
+		if(!ap->ncq) {
+			ap->nslots = 1;
+		}else if(ap->nslots > ncs) {
+			ap->nslots = ncs;
+		}
+		if(ap->ncq) {
+			cprintf("   disk(%d, %d): NCQ, %d slots\n", DEV_SATA, d, ap->nslots);
+		}
+	}
+
+	// Route the controller's interrupt to ahciintr.
+	uint8 irq = ahci_read(bus, slot, func, AHCI_INTR_OFFSET) & 0xFF;
+	if(sataDeviceCount > firstDevice && irq != 0 && irq < MAX_IRQS &&
+	   irq != IRQ_IDE1 && irq != IRQ_IDE2 && irq_register_handler(irq, ahciintr)) {
+		picenable(irq);
+		ioapicenable(irq, ncpu - 1);
+		ptr->ghc |= AHCI_GHC_IE;
+		ahciirq = 1;
+		cprintf("   interrupts on irq %d\n", irq);
+	}
 }
 
 ushort ahci_probe(ushort bus, ushort slot, uint16 func, ushort offset){
@@ -202,10 +386,30 @@ int sata_read(uint32 dev, uint64 lba, uint32 count, uint8 *buf) {
 	return ahci_sata_read(port, lbal, lbah, count, buf);
 }
 
-int ahci_sata_read(HBA_PORT *port, uint32 startl, uint32 starth, uint32 count, uint8 *buf) {
-	port->is = (uint32) -1; // Clear pending interrupt bits
+// Build and run one command moving the nsg pieces of sg, in order,
+// to or from the sectors starting at startl/starth. Each piece gets
+// its own PRDT entry, so the pages need not be contiguous. Commands
+// without data, such as FLUSH CACHE, pass nsg 0 and may set feature.
+static int ahci_command(HBA_PORT *port, uint8 command, uint8 feature, int flags, uint32 startl, uint32 starth, struct sata_sg *sg, int nsg) {
+	struct ahciport *ap = ahci_portstate(port);
 	int spin = 0; // Spin lock timeout counter
-	int32 slot = ahci_find_cmdslot(port);
+	int ncq = (command == ATA_CMD_READ_FPDMA || command == ATA_CMD_WRITE_FPDMA);
+	uint32 count = 0;
+	int i;
+
+	if (nsg < 0 || nsg > AHCI_PRDT_MAX)
+		panic("Unsupported request - too many PRDT entries.");
+	for (i = 0; i < nsg; i++) {
+		if ((V2P(sg[i].addr) & 0x1) || (sg[i].len & 0x1) ||
+		    sg[i].len == 0 || sg[i].len > AHCI_PRD_MAXBYTES)
+			panic("Bad SATA PRD - must be word aligned and at most 4M.");
+		count += sg[i].len;
+	}
+	if (count % 512 || count / 512 > 0xFFFF)
+		panic("SATA request not whole sectors or too long.");
+	count /= 512;
+
+	int32 slot = ahci_claimslot(port, ap && ap->ncq && !ncq);
 	if (slot == -1)
 		return SATA_IO_ERROR_NO_SLOT;
 
@@ -214,45 +418,33 @@ int ahci_sata_read(HBA_PORT *port, uint32 startl, uint32 starth, uint32 count, u
 		);
 	cmdheader += slot;
 	cmdheader->cfl = sizeof(FIS_REG_H2D)/sizeof(uint32); // Command FIS size
-	cmdheader->w = 0; // Read from device
-	cmdheader->prdtl = (uint16)((count-1)>>4) + 1; // PRDT entries count
+	cmdheader->w = (flags & AHCI_CMD_WRITE) != 0; // 1: write to device, 0: read from device
+	cmdheader->c = 0;
+	cmdheader->prdtl = nsg; // PRDT entries count
 
 	HBA_CMD_TBL *cmdtbl = (HBA_CMD_TBL*) P2V(
 		HILO2ADDR(cmdheader->ctbau, cmdheader->ctba)
 		);
-	// cprintf("cmdtbl: %x, cmdheader: %x, prdtl: %x, ctbau: %x, ctba: %x, slot: %d\n", cmdtbl, cmdheader, cmdheader->prdtl, cmdheader->ctbau, cmdheader->ctba, slot);
 
 	memset(cmdtbl, 0, sizeof(HBA_CMD_TBL) +
-	       (cmdheader->prdtl-1)*sizeof(HBA_PRDT_ENTRY));
+	       (nsg > 0 ? nsg-1 : 0)*sizeof(HBA_PRDT_ENTRY));
 
-	// 8K bytes (16 sectors) per PRDT
-	uint64 addr = V2P(buf);
-	if (addr & 0x1) {
-		panic("SATA CBA address not word aligned.");
-	}
-	int i;
-	for (i=0; i < cmdheader->prdtl - 1; i++) {
-		panic("Unsupported read request - only single sector reads are supported.");
+	for (i = 0; i < nsg; i++) {
+		uint64 addr = V2P(sg[i].addr);
 		cmdtbl->prdt_entry[i].dba = ADDRLO(addr);
 		cmdtbl->prdt_entry[i].dbau = ADDRHI(addr);
-		cmdtbl->prdt_entry[i].dbc = 8*1024-1;   // 8K bytes (this value should always be set to 1 less than the actual value)
-		cmdtbl->prdt_entry[i].i = 1;
-		buf += 4*1024;  // 4K words
-		count -= 16;    // 16 sectors
+		cmdtbl->prdt_entry[i].dbc = sg[i].len-1; // 0-based. So 0 means 1, 1 means 2, etc.
 	}
-	// Last entry
-	cmdtbl->prdt_entry[i].dba = ADDRLO(addr);
-	cmdtbl->prdt_entry[i].dbau = ADDRHI(addr);
-	cmdtbl->prdt_entry[i].dbc = 511; // 512 bytes per sector, 0-based. So 0 means 1, 1 means 2, etc.
-	cmdtbl->prdt_entry[i].i = 1;
+	if (nsg > 0)
+		cmdtbl->prdt_entry[nsg-1].i = 1;
 
 	// Setup command
 	FIS_REG_H2D *cmdfis = (FIS_REG_H2D*)(&cmdtbl->cfis);
 
 	cmdfis->fis_type = FIS_TYPE_REG_H2D;
 	cmdfis->c = 1; // Command
-	cmdfis->command = ATA_CMD_READ_DMA_EX;
-
+	cmdfis->command = command;
+	cmdfis->featurel = feature;
 
 	cmdfis->lba0 = (uint8)startl;
 	cmdfis->lba1 = (uint8)(startl>>8);
@@ -263,20 +455,54 @@ int ahci_sata_read(HBA_PORT *port, uint32 startl, uint32 starth, uint32 count, u
 	cmdfis->lba4 = (uint8)starth;
 	cmdfis->lba5 = (uint8)(starth>>8);
 
-	cmdfis->countl = count & 0xFF;
-	cmdfis->counth = (count >> 8) & 0xFF;
+	if (ncq) {
+		// Queued commands carry the count in the features
+		// register and the slot as the tag.
+		cmdfis->featurel = count & 0xFF;
+		cmdfis->featureh = (count >> 8) & 0xFF;
+		cmdfis->countl = slot << 3;
+		cmdfis->counth = 0;
+		if (flags & AHCI_CMD_FUA)
+			cmdfis->device |= ATA_DEV_FUA;
+	} else {
+		cmdfis->countl = count & 0xFF;
+		cmdfis->counth = (count >> 8) & 0xFF;
+
+		// The below loop waits until the port is no longer busy before issuing a new command
+		while ((port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && spin < SATA_IO_MAX_WAIT) {
+			spin++;
+		}
+		if (spin == SATA_IO_MAX_WAIT) {
+			ahci_releaseslot(port, slot);
+			return SATA_IO_ERROR_HUNG_PORT;
+		}
+	}
+
+	return wait_for_sata_command(port, slot, ncq);
+}
 
-	// The below loop waits until the port is no longer busy before issuing a new command
-	while ((port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && spin < SATA_IO_MAX_WAIT) {
-		spin++;
+int sata_readv(uint32 dev, uint64 lba, struct sata_sg *sg, int nsg) {
+	if( dev >= AHCI_MAX_SLOT) {
+		return SATA_IO_ERROR_DEV_GT_MAX_SLOT;
 	}
-	if (spin == SATA_IO_MAX_WAIT) {
-		return SATA_IO_ERROR_HUNG_PORT;
+	HBA_PORT *port = BLOCK_DEVICES[dev];
+	if(!port) {
+		return SATA_IO_ERROR_NO_PORT;
 	}
+	return ahci_sata_readv(port, (uint32)lba, (uint32)(lba >> 32), sg, nsg);
+}
 
-	port->ci = 1<<slot; // Issue command
+int ahci_sata_readv(HBA_PORT *port, uint32 startl, uint32 starth, struct sata_sg *sg, int nsg) {
+	struct ahciport *ap = ahci_portstate(port);
+	uint8 command = (ap && ap->ncq) ? ATA_CMD_READ_FPDMA : ATA_CMD_READ_DMA_EX;
 
-	return wait_for_sata_command(port, slot);
+	return ahci_command(port, command, 0, 0, startl, starth, sg, nsg);
+}
+
+int ahci_sata_read(HBA_PORT *port, uint32 startl, uint32 starth, uint32 count, uint8 *buf) {
+	struct sata_sg sg = { buf, count * 512 };
+
+	return ahci_sata_readv(port, startl, starth, &sg, 1);
 }
 
 
@@ -294,80 +520,107 @@ int sata_write(uint32 dev, uint64 lba, uint32 count, uint8 *buf) {
 }
 
 
-int ahci_sata_write(HBA_PORT *port, uint32 startl, uint32 starth, uint32 count, uint8 *buf) {
-    port->is = (uint32) -1;
-	int spin = 0; // Spin lock timeout counter
-
-    int32 slot = ahci_find_cmdslot(port);
-	if (slot == -1)
-		return SATA_IO_ERROR_NO_SLOT;
-
-	HBA_CMD_HEADER *cmdheader = (HBA_CMD_HEADER*) P2V(
-		HILO2ADDR(port->clbu, port->clb)
-		);
-
-    cmdheader += slot;
-
-    cmdheader->cfl = sizeof(FIS_REG_H2D)/sizeof(uint32); // Command FIS size
-    cmdheader->w = 1; // Write to device
-    cmdheader->c = 1;
-    cmdheader->prdtl = 1;    // PRDT entries count
-
-	HBA_CMD_TBL *cmdtbl = (HBA_CMD_TBL*) P2V(
-		HILO2ADDR(cmdheader->ctbau, cmdheader->ctba)
-		);
-	memset(cmdtbl, 0, sizeof(HBA_CMD_TBL) +
-	       (cmdheader->prdtl-1)*sizeof(HBA_PRDT_ENTRY));
-
-	uint64 addr = V2P(buf);
-	if (addr & 0x1) {
-		panic("SATA CBA address not word aligned.");
+int sata_writev(uint32 dev, uint64 lba, struct sata_sg *sg, int nsg, int fua) {
+	if( dev >= AHCI_MAX_SLOT) {
+		return SATA_IO_ERROR_DEV_GT_MAX_SLOT;
 	}
-	cmdtbl->prdt_entry[0].dba = ADDRLO(addr);
-	cmdtbl->prdt_entry[0].dbau = ADDRHI(addr);
-	cmdtbl->prdt_entry[0].dbc = 511; // 512 bytes per sector
-	cmdtbl->prdt_entry[0].i = 0;
-
-    // Setup command
-    FIS_REG_H2D *cmdfis = (FIS_REG_H2D*)(&cmdtbl->cfis);
-
-    cmdfis->fis_type = FIS_TYPE_REG_H2D;
-    cmdfis->c = 1;  // Command
-    cmdfis->command = ATA_CMD_WRITE_DMA_EXT;
+	HBA_PORT *port = BLOCK_DEVICES[dev];
+	if(!port) {
+		return SATA_IO_ERROR_NO_PORT;
+	}
+	return ahci_sata_writev(port, (uint32)lba, (uint32)(lba >> 32), sg, nsg, fua);
+}
 
-    cmdfis->lba0 = (uint8)startl;
-    cmdfis->lba1 = (uint8)(startl>>8);
-    cmdfis->lba2 = (uint8)(startl>>16);
-    cmdfis->device = 1<<6;  // LBA mode
+// Write; with fua set, don't complete until the data is on the
+// media. Drives without FUA writes get a cache flush after.
+int ahci_sata_writev(HBA_PORT *port, uint32 startl, uint32 starth, struct sata_sg *sg, int nsg, int fua) {
+	struct ahciport *ap = ahci_portstate(port);
+	uint8 command = (ap && ap->ncq) ? ATA_CMD_WRITE_FPDMA : ATA_CMD_WRITE_DMA_EXT;
+	int flags = AHCI_CMD_WRITE, status;
+
+	if (fua && (ap == 0 || !ap->wcache))
+		fua = 0; // write-through already
+	if (fua && ap->fua) {
+		flags |= AHCI_CMD_FUA;
+		if (!ap->ncq)
+			command = ATA_CMD_WRITE_DMA_FUA_EXT;
+	}
+	status = ahci_command(port, command, 0, flags, startl, starth, sg, nsg);
+	if (status == SATA_IO_SUCCESS && fua && !ap->fua)
+		status = ahci_sata_flush(port);
+	return status;
+}
 
-    cmdfis->lba3 = (uint8)(startl>>24);
-    cmdfis->lba4 = (uint8)starth;
-    cmdfis->lba5 = (uint8)(starth>>8);
+int ahci_sata_write(HBA_PORT *port, uint32 startl, uint32 starth, uint32 count, uint8 *buf) {
+	struct sata_sg sg = { buf, count * 512 };
 
-    cmdfis->countl = 2;
-    cmdfis->counth = 0;
+	return ahci_sata_writev(port, startl, starth, &sg, 1, 0);
+}
 
-	// The below loop waits until the port is no longer busy before issuing a new command
-	while ((port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && spin < SATA_IO_MAX_WAIT) {
-		spin++;
+int sata_flush(uint32 dev) {
+	if( dev >= AHCI_MAX_SLOT) {
+		return SATA_IO_ERROR_DEV_GT_MAX_SLOT;
 	}
-	if (spin == SATA_IO_MAX_WAIT) {
-		return SATA_IO_ERROR_HUNG_PORT;
+	HBA_PORT *port = BLOCK_DEVICES[dev];
+	if(!port) {
+		return SATA_IO_ERROR_NO_PORT;
 	}
+	return ahci_sata_flush(port);
+}
 
-    port->ci = 1<<slot; // Issue command
+// Write the drive's volatile cache out to the media. Covers the
+// writes that have completed when it is issued.
+int ahci_sata_flush(HBA_PORT *port) {
+	struct ahciport *ap = ahci_portstate(port);
 
-	return wait_for_sata_command(port, slot);
+	if (ap == 0 || !ap->wcache)
+		return SATA_IO_SUCCESS;
+	return ahci_command(port, ap->flushcmd, 0, 0, 0, 0, 0, 0);
+}
+
+// Read the drive's IDENTIFY DEVICE data (256 words) into buf.
+static int ahci_identify(HBA_PORT *port, uint16 *buf) {
+	struct sata_sg sg = { (uint8*)buf, 512 };
+
+	return ahci_command(port, ATA_CMD_IDENTIFY, 0, 0, 0, 0, &sg, 1);
 }
 
 void ahci_sata_init(HBA_PORT *port, int num){
 	if(ahci_rebase_port(port,num) > 0) {
 		uint8 buf[512];
+		uint16 id[256];
+		int ncq = 0, depth = 1, wcache = 0, fua = 0;
+		uint8 flushcmd = ATA_CMD_FLUSH_CACHE;
+		if(ahci_identify(port, &id[0]) == SATA_IO_SUCCESS) {
+			// Word 76 bit 8: NCQ supported; word 75: queue depth - 1.
+			if(id[76] & (1<<8)) {
+				ncq = 1;
+				depth = (id[75] & 0x1F) + 1;
+			}
+			// Word 82 bit 5: write cache supported, word 85 bit 5: on.
+			// Keep it on: log.c orders its writes with flushes and FUA.
+			if(id[82] & (1<<5)) {
+				wcache = (id[85] & (1<<5)) ||
+				         ahci_command(port, ATA_CMD_SET_FEATURES, ATA_FEATURE_WCACHE_ON, 0, 0, 0, 0, 0) == SATA_IO_SUCCESS;
+			}
+			// Word 83 bit 13: FLUSH CACHE EXT, word 84 bit 6: FUA writes.
+			if(id[83] & (1<<13))
+				flushcmd = ATA_CMD_FLUSH_CACHE_EXT;
+			fua = (id[84] & (1<<6)) != 0;
+		}
 		int result = ahci_sata_read(port, 0, 0, 1, &buf[0]);
 		if(result == SATA_IO_SUCCESS) {
 			uint32 devNum = sataDeviceCount++;
 			cprintf("   Init success: disk(%d, %d)\n", DEV_SATA, devNum);
 			BLOCK_DEVICES[devNum] = port;
+			ahciports[devNum].port = port;
+			ahciports[devNum].num = num;
+			ahciports[devNum].ncq = ncq;
+			ahciports[devNum].nslots = depth;
+			ahciports[devNum].wcache = wcache;
+			ahciports[devNum].fua = fua;
+			ahciports[devNum].flushcmd = flushcmd;
+			initlock(&ahciports[devNum].lock, "ahci");
 			if(devNum == 0){
 				ROOT_DEV = TODEVNUM(DEV_SATA, 0);
 			}
@@ -406,15 +659,12 @@ int8 ahci_rebase_port(HBA_PORT *port, int num) {
 	HBA_CMD_HEADER *cmdheader = (HBA_CMD_HEADER *) addr;
 
 	for (uint8 i = 0; i < 32; i++) {
-		cmdheader[i].prdtl = 8; // 8 prdt entries per command table
-		                        // 256 bytes per command table, 64+16+48+16*8
-		                        // Command table offset: 40K + 8K*portno + cmdheader_index*256
-		cmdheader[i].ctba = (((uint64) ahciBase
-		                      + (uint64) ((40 << 10) / 8) + (uint64) ((i << 8) / 8))
-		                     & 0xffffffff);
-		cmdheader[i].ctbau =
-			((((uint64) ahciBase + (uint64) ((40 << 10) / 8)
-			   + (uint64) ((i << 8) / 8)) >> 32) & 0xffffffff);
+		cmdheader[i].prdtl = AHCI_PRDT_MAX; // prdt entries per command table
+		                        // 4K per command table, 64+16+48+16*AHCI_PRDT_MAX
+		                        // Command table offset: 40K + cmdheader_index*4K
+		uint64 ctba = ahciBase + (40 << 10) + (i << 12);
+		cmdheader[i].ctba = ADDRLO(ctba);
+		cmdheader[i].ctbau = ADDRHI(ctba);
 	}
 
 	ahci_start_port(port);
@@ -1,21 +1,44 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
-// * To get a buffer for a particular disk block, call bread.
+// * To get a buffer for a particular disk block, call bread,
+//     or breadn for a block of several sectors (up to BLOCK_MAX_SIZE
+//     bytes), which is read with a single device command.
+//     bgetblk skips the read for a sector about to be overwritten.
+// * I/O that bypasses the cache (O_DIRECT) asks bbypass first.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * Disk reads and writes go through the block request layer
+//     (blk.c); to batch several, plug the device and call
+//     blksubmit and blkwait directly.
 //
-// The implementation uses three state flags internally:
-// * B_BUSY: the block has been returned from bread
-//     and has not been passed back to brelse.
+// A buffer returned by bread is locked with its sleeplock until
+// brelse. b->refcnt counts the processes using or waiting for it;
+// only buffers with no references are recycled.
+//
+// Cached buffers are found through a hash table on (dev, sector).
+// Each chain is protected by one of NHLOCK striped locks, so lookups
+// of different blocks don't contend. Buffers that may be recycled sit
+// on an LRU list with its own lock. The list is maintained lazily:
+// brelse puts a buffer on it once nobody uses it, and bget drops
+// buffers that turn out to be in use or dirty when it looks for a
+// victim at the tail.
+// Lock order: bcache.lrulock, then a hash lock.
+//
+// Buffers are allocated on demand, a header plus a page of data each.
+// bsizeinit() lets the cache grow to a share of memory; when kalloc()
+// runs out it calls bshrink() to free idle buffers. If every buffer is
+// in use or waiting for the log, bget waits for one to be released.
+//
+// The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
@@ -23,144 +46,469 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "buf.h"
-#include "ahci.h"
 #include "kernel/string.h"
 
+#define NHTABPAGE 32                     // pages of hash chain heads
+#define NHPERPAGE (PGSIZE / sizeof(struct buf*))
+#define NHASH     (NHTABPAGE * NHPERPAGE)
+#define NHLOCK    64
+
 struct {
-	struct spinlock lock;
-	struct buf buf[NBUF];
+	struct buf** htab[NHTABPAGE];
+	struct spinlock hlock[NHLOCK];
 
-	// Linked list of all buffers, through prev/next.
-	// head.next is most recently used.
-	struct buf head;
+	// Recycling candidates, through prev/next.
+	// lru.next is most recently used.
+	// lrulock also protects the counts and the free headers.
+	struct spinlock lrulock;
+	struct buf lru;
+	struct buf* freehdr;  // unused headers, through next
+	int nbuf;             // buffers allocated
+	int nwait;            // processes waiting in bget for a buffer
+	int max;              // grow up to this many buffers
+	uint low;             // but not with fewer free pages than this
 } bcache;
 
+static uint bhash(uint dev, uint sector){
+	return (dev * 31 + sector) % NHASH;
+}
+
+static struct spinlock* bhashlock(uint h){
+	return &bcache.hlock[h % NHLOCK];
+}
+
+static struct buf** bchain(uint h){
+	return &bcache.htab[h / NHPERPAGE][h % NHPERPAGE];
+}
+
+// Unlink b from its hash chain. Caller holds the hash lock.
+static void bunhash(uint h, struct buf* b){
+	if (b->hprev)
+		b->hprev->hnext = b->hnext;
+	else
+		*bchain(h) = b->hnext;
+	if (b->hnext)
+		b->hnext->hprev = b->hprev;
+	b->hnext = b->hprev = 0;
+}
+
+// Unlink b from the LRU list. Caller holds lrulock.
+static void lruremove(struct buf* b){
+	b->next->prev = b->prev;
+	b->prev->next = b->next;
+	b->inlru = 0;
+}
+
+// Put b on the LRU list, at the head (most recently used) or tail.
+// Caller holds lrulock.
+static void lruinsert(struct buf* b, int head){
+	struct buf* at = head ? &bcache.lru : bcache.lru.prev;
+
+	if (b->inlru)
+		lruremove(b);
+	b->next = at->next;
+	b->prev = at;
+	at->next->prev = b;
+	at->next = b;
+	b->inlru = 1;
+}
+
 void binit(void){
+	int i;
+
+	initlock(&bcache.lrulock, "bcache");
+	for (i = 0; i < NHLOCK; i++)
+		initlock(&bcache.hlock[i], "bcache.hash");
+	for (i = 0; i < NHTABPAGE; i++) {
+		if ((bcache.htab[i] = (struct buf**)kalloc()) == 0)
+			panic("binit");
+		memset(bcache.htab[i], 0, PGSIZE);
+	}
+	bcache.lru.prev = &bcache.lru;
+	bcache.lru.next = &bcache.lru;
+	bcache.max = NBUF;
+}
+
+// Size the cache from the memory left once the kernel is up.
+void bsizeinit(void){
+	uint free = kfreepages();
+
+	acquire(&bcache.lrulock);
+	if (free / BCACHE_MAXFRAC > NBUF)
+		bcache.max = free / BCACHE_MAXFRAC;
+	bcache.low = free / BCACHE_LOWFRAC;
+	release(&bcache.lrulock);
+	cprintf("bcache: up to %d buffers\n", bcache.max);
+}
+
+// Allocate a new, unhashed buffer with one reference, or return 0.
+// Past max only if force is set. Must not hold bcache locks:
+// kalloc() may call bshrink().
+static struct buf* bnew(int force){
+	struct buf* b, * h;
+	char* data, * page;
+	int i;
+
+	acquire(&bcache.lrulock);
+	if (!force && (bcache.nbuf >= bcache.max || kfreepages() < bcache.low)) {
+		release(&bcache.lrulock);
+		return 0;
+	}
+	bcache.nbuf++;  // reserve our slot
+	release(&bcache.lrulock);
+
+	b = 0;
+	if ((data = kalloc()) != 0) {
+		acquire(&bcache.lrulock);
+		if (bcache.freehdr == 0) {
+			release(&bcache.lrulock);
+			if ((page = kalloc()) != 0) {
+				// Carve the page into headers.
+				memset(page, 0, PGSIZE);
+				acquire(&bcache.lrulock);
+				for (i = 0; i < PGSIZE / sizeof(struct buf); i++) {
+					h = (struct buf*)page + i;
+					initsleeplock(&h->lock, "buffer");
+					h->next = bcache.freehdr;
+					bcache.freehdr = h;
+				}
+			} else
+				acquire(&bcache.lrulock);
+		}
+		if ((b = bcache.freehdr) != 0)
+			bcache.freehdr = b->next;
+		release(&bcache.lrulock);
+	}
+	if (b == 0) {
+		if (data)
+			kfree(data);
+		acquire(&bcache.lrulock);
+		bcache.nbuf--;
+		release(&bcache.lrulock);
+		return 0;
+	}
+	b->data = (uint8*)data;
+	b->dev = -1;
+	b->flags = 0;
+	b->refcnt = 1;
+	b->inlru = 0;
+	b->hnext = b->hprev = 0;
+	return b;
+}
+
+// Find the buffer for sector on device dev in chain h and take a
+// reference to it. Caller holds the hash lock.
+static struct buf* blookup(uint h, uint dev, uint sector){
+	struct buf* b;
+
+	for (b = *bchain(h); b; b = b->hnext) {
+		if (b->dev == dev && b->sector == sector) {
+			b->refcnt++;
+			return b;
+		}
+	}
+	return 0;
+}
+
+// Is sector on device dev in chain h? Takes no reference, so
+// the answer is only a hint. Caller holds the hash lock.
+static int bcached(uint h, uint dev, uint sector){
 	struct buf* b;
 
-	initlock(&bcache.lock, "bcache");
+	for (b = *bchain(h); b; b = b->hnext)
+		if (b->dev == dev && b->sector == sector)
+			return 1;
+	return 0;
+}
+
+// Take the least recently used buffer that nobody uses and that is
+// clean off the LRU list and unhash it. "clean" because B_DIRTY and
+// unused means log.c hasn't yet committed the changes to the buffer.
+// Caller holds lrulock.
+static struct buf* bvictim1(void){
+	struct spinlock* hl;
+	struct buf* b;
+	uint h;
 
+	while ((b = bcache.lru.prev) != &bcache.lru) {
+		lruremove(b);
+		if (b->dev == (uint)-1) {
+			// Not hashed, so nobody else can find it.
+			if (b->refcnt != 0)
+				continue;
+			b->refcnt = 1;
+			return b;
+		}
+		h = bhash(b->dev, b->sector);
+		hl = bhashlock(h);
+		acquire(hl);
+		if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+			bunhash(h, b);
+			b->refcnt = 1;
+			release(hl);
+			return b;
+		}
+		// In use or dirty: brelse puts it back once it can go.
+		release(hl);
+	}
+	return 0;
+}
 
-	// Create linked list of buffers
-	bcache.head.prev = &bcache.head;
-	bcache.head.next = &bcache.head;
-	for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-		b->next = bcache.head.next;
-		b->prev = &bcache.head;
+static struct buf* bvictim(void){
+	struct buf* b;
+
+	acquire(&bcache.lrulock);
+	b = bvictim1();
+	release(&bcache.lrulock);
+	return b;
+}
+
+// Free up to n idle buffers, oldest first, but keep at least NBUF.
+// Returns the number of pages given back.
+int bshrink(int n){
+	struct buf* b, * freed;
+	int done;
+
+	freed = 0;
+	acquire(&bcache.lrulock);
+	for (done = 0; done < n && bcache.nbuf > NBUF; done++) {
+		if ((b = bvictim1()) == 0)
+			break;
+		bcache.nbuf--;
+		b->next = freed;
+		freed = b;
+	}
+	release(&bcache.lrulock);
+
+	// kfree outside lrulock; then recycle the headers.
+	for (b = freed; b; b = b->next) {
+		kfree((char*)b->data);
+		b->data = 0;
 		b->dev = -1;
-		bcache.head.next->prev = b;
-		bcache.head.next = b;
+		b->refcnt = 0;
+	}
+	acquire(&bcache.lrulock);
+	while ((b = freed) != 0) {
+		freed = b->next;
+		b->next = bcache.freehdr;
+		bcache.freehdr = b;
 	}
+	release(&bcache.lrulock);
+	return done;
+}
+
+// A file system reads a block with the same size every time, but
+// if a cached block is asked for with another size, read it again.
+// A dirty block is pinned by the log until a checkpoint writes it
+// home; writing it here would go around the log, so refuse.
+static void bresize(struct buf* b, uint size){
+	if (b->size == size)
+		return;
+	if (b->flags & B_DIRTY)
+		panic("bresize: dirty");
+	b->size = size;
+	b->flags &= ~B_VALID;
 }
 
 // Look through buffer cache for sector on device dev.
 // If not found, allocate a buffer.
-// In either case, return B_BUSY buffer.
-static struct buf* bget(uint dev, uint sector){
-	struct buf* b;
-
-	acquire(&bcache.lock);
+// In either case, return locked buffer of the given size.
+static struct buf* bget(uint dev, uint sector, uint size){
+	uint h = bhash(dev, sector);
+	struct spinlock* hl = bhashlock(h);
+	struct buf* b, * victim;
+	int waiting;
 
-loop:
 	// Is the sector already cached?
-	for (b = bcache.head.next; b != &bcache.head; b = b->next) {
-		if (b->dev == dev && b->sector == sector) {
-			if (!(b->flags & B_BUSY)) {
-				b->flags |= B_BUSY;
-				release(&bcache.lock);
-				return b;
-			}
-			sleep(b, &bcache.lock);
-			goto loop;
-		}
+	acquire(hl);
+	b = blookup(h, dev, sector);
+	release(hl);
+	if (b) {
+		acquiresleep(&b->lock);
+		bresize(b, size);
+		return b;
 	}
 
-	// Not cached; recycle some non-busy and clean buffer.
-	// "clean" because B_DIRTY and !B_BUSY means log.c
-	// hasn't yet committed the changes to the buffer.
-	for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
-		if ((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0) {
-			b->dev = dev;
-			b->sector = sector;
-			b->flags = B_BUSY;
-			release(&bcache.lock);
-			return b;
+	// Not cached; grow the cache while there is room, else recycle
+	// a buffer, else grow past the limit if there is memory at all.
+	// If everything is in use or waiting for the log, wait for a
+	// buffer to be released.
+	while ((victim = bnew(0)) == 0 &&
+	       (victim = bvictim()) == 0 &&
+	       (victim = bnew(1)) == 0) {
+		acquire(&bcache.lrulock);
+		if (bcache.lru.prev == &bcache.lru) {
+			bcache.nwait++;
+			sleep(&bcache, &bcache.lrulock);
+			bcache.nwait--;
 		}
+		release(&bcache.lrulock);
 	}
-	panic("bget: no buffers");
+
+	// Another process may have cached the sector meanwhile.
+	acquire(hl);
+	if ((b = blookup(h, dev, sector)) != 0) {
+		release(hl);
+		victim->dev = -1;
+		victim->refcnt = 0;
+		acquire(&bcache.lrulock);
+		lruinsert(victim, 0);
+		waiting = bcache.nwait;
+		release(&bcache.lrulock);
+		if (waiting)
+			wakeup(&bcache);
+		acquiresleep(&b->lock);
+		bresize(b, size);
+		return b;
+	}
+	b = victim;
+	b->dev = dev;
+	b->sector = sector;
+	b->size = size;
+	b->flags = 0;
+	b->hprev = 0;
+	b->hnext = *bchain(h);
+	if (b->hnext)
+		b->hnext->hprev = b;
+	*bchain(h) = b;
+	release(hl);
+	acquiresleep(&b->lock);
+	return b;
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
-struct buf* bread(uint dev, uint sector){
+// Return a locked buf with the contents of the size bytes
+// starting at the indicated disk sector.
+struct buf* breadn(uint dev, uint sector, uint size){
 	struct buf* b;
 
-	b = bget(dev, sector);
+	if (size == 0 || size > BLOCK_MAX_SIZE || size % SECTOR_SIZE)
+		panic("breadn: bad size");
+	b = bget(dev, sector, size);
 	if (!(b->flags & B_VALID)) {
-		uint8 devType = GETDEVTYPE(dev);
-		uint32 devNum = GETDEVNUM(dev);
-
-		if(devType == DEV_IDE) {
-			iderw(b);
-		} else if(devType == DEV_SATA) {
-			int status = sata_read(devNum, sector, 1, &b->data[0]);
-			if(status != SATA_IO_SUCCESS){
-				cprintf("Error reading SATA: %d\n", status);
-				panic("SATA I/O ERROR");
-			}
-			b->flags |= B_VALID;
-			b->flags &= ~B_DIRTY;
-			wakeup(b);
-		} else {
-			panic("Unsupported device type");
-		}
+		blksubmit(b);
+		blkwait(b);
 	}
 	return b;
 }
 
-// Write b's contents to disk.  Must be B_BUSY.
+// Return a locked buf with the contents of the indicated disk sector.
+struct buf* bread(uint dev, uint sector){
+	return breadn(dev, sector, SECTOR_SIZE);
+}
+
+// Return a locked buf for the indicated sector without reading
+// it, for a caller that is about to overwrite all of it.
+struct buf* bgetblk(uint dev, uint sector){
+	struct buf* b;
+
+	b = bget(dev, sector, SECTOR_SIZE);
+	b->flags |= B_VALID;
+	return b;
+}
+
+// Whether I/O to the indicated sector may bypass the cache.
+// A read may not if the sector is cached: the copy there is
+// current, and may not be on disk yet. A write may not if the
+// cached copy has changes waiting for the log; a clean one is
+// invalidated, as the write will leave it stale.
+int bbypass(uint dev, uint sector, int write){
+	uint h = bhash(dev, sector);
+	struct spinlock* hl = bhashlock(h);
+	struct buf* b;
+	int ok;
+
+	acquire(hl);
+	b = blookup(h, dev, sector);
+	release(hl);
+	if (b == 0)
+		return 1;
+	acquiresleep(&b->lock);
+	if (!(b->flags & B_VALID))
+		ok = 1;
+	else if (!write)
+		ok = 0;
+	else if (b->flags & B_DIRTY)
+		ok = 0;
+	else {
+		b->flags &= ~B_VALID;
+		ok = 1;
+	}
+	brelse(b);
+	return ok;
+}
+
+// Start reading the indicated sector into the cache without
+// waiting for it; a later bread finds it there. Does nothing
+// if the sector is cached already.
+void breada(uint dev, uint sector){
+	uint h = bhash(dev, sector);
+	struct spinlock* hl = bhashlock(h);
+	struct buf* b;
+	int cached;
+
+	acquire(hl);
+	cached = bcached(h, dev, sector);
+	release(hl);
+	if (cached)
+		return;
+	b = bget(dev, sector, SECTOR_SIZE);
+	if (b->flags & B_VALID) {
+		brelse(b);
+		return;
+	}
+	b->flags |= B_ASYNC;
+	blksubmit(b);
+}
+
+// Write b's contents to disk.  Must be locked.
 void bwrite(struct buf* b){
-	if ((b->flags & B_BUSY) == 0)
+	if (!holdingsleep(&b->lock))
 		panic("bwrite");
 	b->flags |= B_DIRTY;
-	uint8 devType = GETDEVTYPE(b->dev);
-	uint32 devNum = GETDEVNUM(b->dev);
-
-	if(devType == DEV_IDE) {
-		iderw(b);
-	} else {
-		int status = sata_write(devNum, b->sector, 1, &b->data[0]);
-		b->flags |= B_VALID;
-		b->flags &= ~B_DIRTY;
-		wakeup(b);
-		if(status != SATA_IO_SUCCESS){
-			cprintf("Error writing SATA: %d\n", status);
-			panic("SATA I/O ERROR");
-		}
-	}
+	blksubmit(b);
+	blkwait(b);
 }
 
-// Release a B_BUSY buffer.
-// Move to the head of the MRU list.
-void brelse(struct buf* b){
-	if ((b->flags & B_BUSY) == 0)
-		panic("brelse");
-
-	acquire(&bcache.lock);
+// Unlock b and drop a reference to it.
+static void bput(struct buf* b){
+	struct spinlock* hl;
+	int idle;
 
-	b->next->prev = b->prev;
-	b->prev->next = b->next;
-	b->next = bcache.head.next;
-	b->prev = &bcache.head;
-	bcache.head.next->prev = b;
-	bcache.head.next = b;
+	releasesleep(&b->lock);
 
-	b->flags &= ~B_BUSY;
-	wakeup(b);
+	hl = bhashlock(bhash(b->dev, b->sector));
+	acquire(hl);
+	b->refcnt--;
+	idle = b->refcnt == 0 && (b->flags & B_DIRTY) == 0;
+	release(hl);
 
-	release(&bcache.lock);
+	// Someone may take it again before we get lrulock;
+	// bvictim() checks before recycling it.
+	if (idle) {
+		acquire(&bcache.lrulock);
+		lruinsert(b, 1);
+		idle = bcache.nwait;
+		release(&bcache.lrulock);
+		if (idle)
+			wakeup(&bcache);
+	}
 }
 
+// Release a locked buffer.
+// Once nobody uses it, it becomes the most recently used
+// recycling candidate.
+void brelse(struct buf* b){
+	if (!holdingsleep(&b->lock))
+		panic("brelse");
+	bput(b);
+}
 
-// Blank page.
+// Release a buffer whose read was started by breada. The block
+// layer calls this when the I/O completes, in whichever process
+// finished it.
+void brelseasync(struct buf* b){
+	bput(b);
+}
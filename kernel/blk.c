@@ -0,0 +1,327 @@
+// Block request layer between the buffer cache and the disk drivers.
+//
+// The buffer cache hands a locked buffer to blksubmit() and waits
+// for it with blkwait(). Each device has a queue of buffers kept
+// sorted by sector. blkdispatch() sends the next run of them to the
+// driver as one command:
+// * Runs are taken in elevator order: ascending sectors from where
+//   the last dispatch ended, wrapping to the lowest (C-LOOK). A
+//   request that has waited past its deadline is taken first.
+// * Buffers for adjacent sectors going the same way are merged,
+//   chained through mnext, up to BLK_MAXSECTORS and BLK_MAXBUFS.
+// * While a queue is plugged with blkplug(), submissions collect
+//   so that a caller issuing many requests gets them merged;
+//   blkunplug() sends them on.
+//
+// Processes that submit or wait for a request dispatch the queue
+// themselves, so a waiter never sits behind a plug. Requests that
+// nobody waits for, marked B_ASYNC (readahead), are left to the
+// kblockd thread, and the buffer is released when the I/O completes.
+// A buffer is B_QUEUED while in a queue and B_INFLIGHT from
+// submission until its I/O is complete.
+//
+// Disks may hold completed writes in a volatile cache. A write
+// marked B_FUA is on the media when it completes, and blkflush()
+// pushes out every write that has completed so far; the log orders
+// its writes with the two.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "buf.h"
+#include "ahci.h"
+
+#define NBLKQ 8  // devices with a queue
+
+struct blkqueue {
+	struct spinlock lock;
+	int used;
+	uint dev;
+	int plugged;       // blkplug() depth
+	uint pos;          // sector just past the last dispatch
+	struct buf* head;  // queued buffers, sorted by sector, linked by qnext
+};
+
+static struct {
+	struct spinlock lock;
+	struct blkqueue q[NBLKQ];
+	int async;  // B_ASYNC requests submitted since kblockd last looked
+} blk;
+
+void blkinit(void){
+	initlock(&blk.lock, "blk");
+}
+
+// Find the queue for dev, setting one up on first use.
+static struct blkqueue* blkqueue(uint dev){
+	struct blkqueue* q;
+
+	acquire(&blk.lock);
+	for (q = blk.q; q < &blk.q[NBLKQ]; q++) {
+		if (q->used && q->dev == dev) {
+			release(&blk.lock);
+			return q;
+		}
+	}
+	for (q = blk.q; q < &blk.q[NBLKQ]; q++) {
+		if (!q->used) {
+			initlock(&q->lock, "blkq");
+			q->dev = dev;
+			q->used = 1;
+			release(&blk.lock);
+			return q;
+		}
+	}
+	panic("blkqueue: no queues");
+}
+
+static inline uint bsectors(struct buf* b){
+	return b->size / SECTOR_SIZE;
+}
+
+// Pick the first buffer of the next run. Caller holds q->lock.
+// Returns the link that points at it, or 0 if q is empty.
+static struct buf** blkpick(struct blkqueue* q){
+	struct buf** pp, ** first, ** oldest;
+	uint age, deadline;
+
+	if (q->head == 0)
+		return 0;
+	first = 0;
+	oldest = &q->head;
+	for (pp = &q->head; *pp; pp = &(*pp)->qnext) {
+		if (first == 0 && (*pp)->sector >= q->pos)
+			first = pp;
+		if ((int)((*pp)->qtime - (*oldest)->qtime) < 0)
+			oldest = pp;
+	}
+	age = ticks - (*oldest)->qtime;
+	deadline = ((*oldest)->flags & B_DIRTY) ? BLK_WRITE_DEADLINE : BLK_READ_DEADLINE;
+	if (age > deadline)
+		return oldest;
+	return first ? first : &q->head;
+}
+
+// Send b and the buffers chained to it to the driver and wait.
+static void blkstart(struct buf* b){
+	struct sata_sg sg[BLK_MAXBUFS];
+	struct buf* p;
+	int n, status;
+
+	switch (GETDEVTYPE(b->dev)) {
+	case DEV_IDE:
+		iderw(b);
+		if (b->flags & B_FUA)
+			ideflush(b->dev); // PIO has no FUA writes
+		break;
+	case DEV_SATA:
+		for (n = 0, p = b; p; p = p->mnext, n++) {
+			sg[n].addr = p->data;
+			sg[n].len = p->size;
+		}
+		if (b->flags & B_DIRTY)
+			status = sata_writev(GETDEVNUM(b->dev), b->sector, sg, n, (b->flags & B_FUA) != 0);
+		else
+			status = sata_readv(GETDEVNUM(b->dev), b->sector, sg, n);
+		if (status != SATA_IO_SUCCESS) {
+			cprintf("Error %s SATA: %d\n", (b->flags & B_DIRTY) ? "writing" : "reading", status);
+			panic("SATA I/O ERROR");
+		}
+		for (p = b; p; p = p->mnext) {
+			p->flags |= B_VALID;
+			p->flags &= ~B_DIRTY;
+		}
+		break;
+	default:
+		panic("Unsupported device type");
+	}
+}
+
+// Dispatch the next run of requests from q, merged into one
+// command. Returns 0 if q was empty.
+static int blkdispatch(struct blkqueue* q){
+	struct buf** pp, * b, * last, * next;
+	uint n, nbuf;
+
+	acquire(&q->lock);
+	if ((pp = blkpick(q)) == 0) {
+		release(&q->lock);
+		return 0;
+	}
+	b = last = *pp;
+	n = bsectors(b);
+	nbuf = 1;
+	last->flags &= ~B_QUEUED;
+	while ((next = last->qnext) != 0 &&
+	       next->sector == last->sector + bsectors(last) &&
+	       (next->flags & (B_DIRTY | B_FUA)) == (b->flags & (B_DIRTY | B_FUA)) &&
+	       n + bsectors(next) <= BLK_MAXSECTORS && nbuf < BLK_MAXBUFS) {
+		last->mnext = next;
+		last = next;
+		last->flags &= ~B_QUEUED;
+		n += bsectors(last);
+		nbuf++;
+	}
+	*pp = last->qnext;
+	last->mnext = 0;
+	q->pos = last->sector + bsectors(last);
+	release(&q->lock);
+
+	blkstart(b);
+
+	acquire(&q->lock);
+	for (; b; b = next) {
+		next = b->mnext;
+		b->flags &= ~(B_INFLIGHT | B_FUA);
+		if (b->flags & B_ASYNC) {
+			b->flags &= ~B_ASYNC;
+			brelseasync(b);
+		} else
+			wakeup(b);
+	}
+	release(&q->lock);
+	return 1;
+}
+
+// Queue I/O for locked buffer b: a write if B_DIRTY is set,
+// else a read. Unless the queue is plugged, dispatch it, or for
+// a B_ASYNC request leave it to kblockd.
+void blksubmit(struct buf* b){
+	struct blkqueue* q = blkqueue(b->dev);
+	struct buf** pp;
+	int plugged, async;
+
+	if (!holdingsleep(&b->lock))
+		panic("blksubmit");
+	acquire(&q->lock);
+	if (b->flags & (B_QUEUED | B_INFLIGHT))
+		panic("blksubmit: busy");
+	b->flags |= B_QUEUED | B_INFLIGHT;
+	b->qtime = ticks;
+	for (pp = &q->head; *pp && (*pp)->sector < b->sector; pp = &(*pp)->qnext)
+		;
+	b->qnext = *pp;
+	*pp = b;
+	plugged = q->plugged;
+	async = b->flags & B_ASYNC; // b may be gone once q->lock is released
+	release(&q->lock);
+
+	if (async) {
+		acquire(&blk.lock);
+		blk.async++;
+		wakeup(&blk.async);
+		release(&blk.lock);
+	} else if (!plugged)
+		while (blkdispatch(q))
+			;
+}
+
+// Wait for the I/O on b to complete, dispatching it
+// if nobody has yet.
+void blkwait(struct buf* b){
+	struct blkqueue* q = blkqueue(b->dev);
+
+	acquire(&q->lock);
+	while (b->flags & B_INFLIGHT) {
+		if (b->flags & B_QUEUED) {
+			release(&q->lock);
+			blkdispatch(q);
+			acquire(&q->lock);
+		} else
+			sleep(b, &q->lock);
+	}
+	release(&q->lock);
+}
+
+// Whether dev can move data straight to or from any memory,
+// such as user pages, with blkdirect().
+int blkdma(uint dev){
+	return GETDEVTYPE(dev) == DEV_SATA;
+}
+
+// Move the sectors starting at sector to or from the nsg pieces
+// of sg, bypassing the cache and the queue. The caller checks
+// blkdma() and, with bbypass(), that no cached copy is involved.
+void blkdirect(uint dev, uint sector, struct sata_sg* sg, int nsg, int write){
+	int status;
+
+	if (!blkdma(dev))
+		panic("blkdirect");
+	if (write)
+		status = sata_writev(GETDEVNUM(dev), sector, sg, nsg, 0);
+	else
+		status = sata_readv(GETDEVNUM(dev), sector, sg, nsg);
+	if (status != SATA_IO_SUCCESS) {
+		cprintf("Error %s SATA: %d\n", write ? "writing" : "reading", status);
+		panic("SATA I/O ERROR");
+	}
+}
+
+// Flush dev's write cache, making the writes completed so far
+// durable.
+void blkflush(uint dev){
+	int status;
+
+	switch (GETDEVTYPE(dev)) {
+	case DEV_IDE:
+		ideflush(dev);
+		break;
+	case DEV_SATA:
+		if ((status = sata_flush(GETDEVNUM(dev))) != SATA_IO_SUCCESS) {
+			cprintf("Error flushing SATA: %d\n", status);
+			panic("SATA I/O ERROR");
+		}
+		break;
+	default:
+		panic("Unsupported device type");
+	}
+}
+
+// Dispatch the requests that nobody is waiting for. Plugged queues
+// are left for blkunplug().
+static void kblockd(void* arg){
+	struct blkqueue* q;
+
+	for (;;) {
+		acquire(&blk.lock);
+		while (blk.async == 0)
+			sleep(&blk.async, &blk.lock);
+		blk.async = 0;
+		release(&blk.lock);
+
+		for (q = blk.q; q < &blk.q[NBLKQ]; q++) {
+			if (q->used && !q->plugged)
+				while (blkdispatch(q))
+					;
+		}
+	}
+}
+
+void kblockdinit(void){
+	kthread("kblockd", kblockd, 0);
+}
+
+// Hold requests for dev in its queue until the matching blkunplug().
+void blkplug(uint dev){
+	struct blkqueue* q = blkqueue(dev);
+
+	acquire(&q->lock);
+	q->plugged++;
+	release(&q->lock);
+}
+
+void blkunplug(uint dev){
+	struct blkqueue* q = blkqueue(dev);
+	int plugged;
+
+	acquire(&q->lock);
+	if (q->plugged < 1)
+		panic("blkunplug");
+	plugged = --q->plugged;
+	release(&q->lock);
+
+	if (!plugged)
+		while (blkdispatch(q))
+			;
+}
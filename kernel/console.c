@@ -302,7 +302,7 @@ void consoleintr(int (*getc)(void)){
 	release(&input.lock);
 }
 
-int consoleread(struct inode* ip, char* dst, int n){
+int consoleread(struct inode* ip, char* dst, uint off, int n){
 	uint target;
 	int c;
 
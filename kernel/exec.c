@@ -31,7 +31,7 @@ int exec(char *path, char **argv) {
 	if(elf.magic != ELF_MAGIC)
 		goto bad;
 
-	if((pgdir = setupkvm()) == 0)
+	if((pgdir = setupkvm()) == 0 || mapvdso(pgdir, proc) < 0)
 		goto bad;
 
 	// Load program into memory.
@@ -28,6 +28,8 @@ filealloc(void){
 	for (f = ftable.file; f < ftable.file + NFILE; f++) {
 		if (f->ref == 0) {
 			f->ref = 1;
+			f->ra.next = f->ra.win = f->ra.ahead = 0;
+			f->direct = 0;
 			release(&ftable.lock);
 			return f;
 		}
@@ -90,8 +92,23 @@ int fileread(struct file* f, char* addr, int n){
 	if (f->type == FD_PIPE)
 		return piperead(f->pipe, addr, n);
 	if (f->type == FD_INODE) {
-		ilock(f->ip);
-		if ((r = readi(f->ip, addr, f->off, n)) > 0)
+		// Readers of one inode share its lock, but f->off and
+		// f->ra belong to f: if another process holds f too,
+		// lock exclusively so that reads of f don't interleave.
+		// If f->ref is 1, only this process holds f and it is
+		// busy here, so nobody can dup f meanwhile.
+		if (f->ref > 1)
+			ilock(f->ip);
+		else
+			ilockshared(f->ip);
+		r = -1;
+		if (f->direct)
+			r = readdirect(f->ip, addr, f->off, n);
+		if (r < 0) {
+			readahead(f->ip, &f->ra, f->off, n);
+			r = readi(f->ip, addr, f->off, n);
+		}
+		if (r > 0)
 			f->off += r;
 		iunlock(f->ip);
 		return r;
@@ -128,23 +145,34 @@ int filewrite(struct file* f, char* addr, int n){
 		// and 2 blocks of slop for non-aligned writes.
 		// this really belongs lower down, since writei()
 		// might be writing a device like the console.
-		int max = ((LOGSIZE - 1 - 1 - 2) / 2) * 512;
+		int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512;
 		int i = 0;
 		while (i < n) {
 			int n1 = n - i;
-			if (n1 > max)
-				n1 = max;
+			int direct = -1;
 
 			begin_op();
 			ilock(f->ip);
-			if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+			if (f->direct) {
+				// Data blocks don't go through the log; a short
+				// write means the transaction ran out of room.
+				if (n1 > BLK_MAXSECTORS * 512)
+					n1 = BLK_MAXSECTORS * 512;
+				direct = r = writedirect(f->ip, addr + i, f->off, n1);
+			}
+			if (direct < 0) {
+				if (n1 > max)
+					n1 = max;
+				r = writei(f->ip, addr + i, f->off, n1);
+			}
+			if (r > 0)
 				f->off += r;
 			iunlock(f->ip);
 			end_op();
 
 			if (r < 0)
 				break;
-			if (r != n1)
+			if (r != n1 && (direct < 0 || r == 0))
 				return r;
 			i += r;
 		}
@@ -54,16 +54,16 @@ int ext2_readi(struct inode *ip, char *dst, uint off, uint n) {
     uint8 devt = GETDEVTYPE(ip->dev);
     uint32 devnum = GETDEVNUM(ip->dev);
 
-    readblock(devt, devnum, 2, sb.block_size, &bgd, sizeof(bgd));
-
     int blocksize = (1024 << sb.block_size);
+    readblock(devt, devnum, 2, blocksize, &bgd, sizeof(bgd));
+
     // int blockgroup = (ip->inum - 1) / sb.inodes_in_group;
     int index = (ip->inum - 1) % sb.inodes_in_group;
     int inodesize = sb.major_ver >= 1 ? sb.inode_size : FS_EXT2_OLD_INODE_SIZE;
     int containingblock = (index * inodesize) / blocksize;
 
     char *buf = kalloc();
-    readblock(devt, devnum, containingblock + 3, sb.block_size, buf, sb.block_size);
+    readblock(devt, devnum, containingblock + 3, blocksize, buf, blocksize);
     memmove(dst, buf + (index * inodesize), inodesize);
     kfree(buf);
     return 1;
@@ -146,14 +146,10 @@ void ext2_readinode(struct inode *ip) {
 
 static inline void readblock(uint16 devt, uint32 devnum, uint64 blocknum, uint32 blocksize, void *buf, int n) {
     uint32 spb = blocksize / DISK_SECTOR_SIZE; // 2
-    uint64 start = blocknum * spb;
     uint32 legacydevid = TODEVNUM(devt, devnum);
 
-    for(uint8 i = 0; i != spb && n > 0; i++) {
-        struct buf* bp = bread(legacydevid, start + i);
-        void *offset = buf + (DISK_SECTOR_SIZE * i);
-        memcopy(offset, &bp->data[0], n > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : 0);
-        n -= DISK_SECTOR_SIZE;
-        brelse(bp);
-    }
+    // The whole block comes in with one multi-sector read.
+    struct buf* bp = breadn(legacydevid, blocknum * spb, blocksize);
+    memcopy(buf, &bp->data[0], n > blocksize ? blocksize : n);
+    brelse(bp);
 }
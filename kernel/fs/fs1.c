@@ -23,9 +23,11 @@
 #include "vfs.h"
 #include "fs/fs1.h"
 #include "file.h"
+#include "ahci.h"
 #include "kernel/string.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
 
 // Read the super block.
 void fs1_readsb(int dev, struct fs1_superblock* sb){
@@ -48,8 +50,9 @@ static void fs1_bzero(int dev, int bno){
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint fs1_balloc(uint dev){
+// Allocate a disk block, zeroed unless the caller
+// is about to overwrite all of it.
+static uint fs1_balloc(uint dev, int zero){
 	int b, bi, m;
 	struct buf* bp;
 	struct fs1_superblock sb;
@@ -64,7 +67,8 @@ static uint fs1_balloc(uint dev){
 				bp->data[bi / 8] |= m; // Mark block in use.
 				log_write(bp);
 				brelse(bp);
-				fs1_bzero(dev, b + bi);
+				if (zero)
+					fs1_bzero(dev, b + bi);
 				return b + bi;
 			}
 		}
@@ -130,9 +134,9 @@ static void fs1_bfree(int dev, uint b){
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode. The I_BUSY flag indicates
-//   that the inode is locked. ilock() sets I_BUSY,
-//   while iunlock clears it.
+//   has first locked the inode. ip->lock is a reader-writer
+//   semaphore: ilock() takes it exclusively, ilockshared()
+//   shared for code that only reads, and iunlock releases it.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -158,7 +162,11 @@ struct {
 } fs1_icache;
 
 void fs1_iinit(void){
+	int i;
+
 	initlock(&fs1_icache.lock, "fs1_icache");
+	for (i = 0; i < NINODE; i++)
+		initrwsem(&fs1_icache.inode[i].lock, "inode");
 }
 
 extern uint64 ROOT_DEV;
@@ -205,6 +213,7 @@ void fs1_iupdate(struct inode* ip){
 	memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
 	log_write(bp);
 	brelse(bp);
+	ip->lsn = logseq();
 }
 
 // Find the inode with number inum on device dev
@@ -259,14 +268,15 @@ struct inode* fs1_idup(struct inode* ip){
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-static uint fs1_bmap(struct inode* ip, uint bn){
+// If there is no such block, bmap allocates one, zeroed if zero
+// is set.
+static uint fs1_bmapalloc(struct inode* ip, uint bn, int zero){
 	uint addr, * a;
 	struct buf* bp;
 
 	if (bn < NDIRECT) {
 		if ((addr = ip->addrs[bn]) == 0)
-			ip->addrs[bn] = addr = fs1_balloc(ip->dev);
+			ip->addrs[bn] = addr = fs1_balloc(ip->dev, zero);
 		return addr;
 	}
 	bn -= NDIRECT;
@@ -274,11 +284,11 @@ static uint fs1_bmap(struct inode* ip, uint bn){
 	if (bn < NINDIRECT) {
 		// Load indirect block, allocating if necessary.
 		if ((addr = ip->addrs[NDIRECT]) == 0)
-			ip->addrs[NDIRECT] = addr = fs1_balloc(ip->dev);
+			ip->addrs[NDIRECT] = addr = fs1_balloc(ip->dev, 1);
 		bp = bread(ip->dev, addr);
 		a = (uint*)bp->data;
 		if ((addr = a[bn]) == 0) {
-			a[bn] = addr = fs1_balloc(ip->dev);
+			a[bn] = addr = fs1_balloc(ip->dev, zero);
 			log_write(bp);
 		}
 		brelse(bp);
@@ -288,6 +298,30 @@ static uint fs1_bmap(struct inode* ip, uint bn){
 	panic("fs1_bmap: out of range");
 }
 
+static uint fs1_bmap(struct inode* ip, uint bn){
+	return fs1_bmapalloc(ip, bn, 1);
+}
+
+// Like fs1_bmap, but return 0 rather than allocate a block.
+static uint fs1_bmaplookup(struct inode* ip, uint bn){
+	uint addr;
+	struct buf* bp;
+
+	if (bn < NDIRECT)
+		return ip->addrs[bn];
+	bn -= NDIRECT;
+
+	if (bn < NINDIRECT) {
+		if ((addr = ip->addrs[NDIRECT]) == 0)
+			return 0;
+		bp = bread(ip->dev, addr);
+		addr = ((uint*)bp->data)[bn];
+		brelse(bp);
+		return addr;
+	}
+	return 0;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -331,6 +365,35 @@ void fs1_stati(struct inode* ip, struct stat* st){
 }
 
 
+// Read ahead of a sequential reader of ip. ra belongs to the open
+// file. Each read that starts where the last one stopped doubles the
+// window, from RA_MINBLOCKS up to RA_MAXBLOCKS, and the blocks up to
+// a window past this read are started in the background; any other
+// read resets it. Caller holds ip's lock.
+void fs1_readahead(struct inode* ip, struct readahead* ra, uint off, uint n){
+	uint bn, last, end, addr;
+
+	if (off != ra->next) {
+		ra->win = 0;
+		ra->ahead = 0;
+	} else if (ra->win == 0)
+		ra->win = RA_MINBLOCKS;
+	else if ((ra->win *= 2) > RA_MAXBLOCKS)
+		ra->win = RA_MAXBLOCKS;
+	ra->next = off + n;
+	if (ra->win == 0 || n == 0 || off >= ip->size)
+		return;
+
+	last = (min(off + n, ip->size) - 1) / BSIZE;
+	end = min(last + ra->win, (ip->size - 1) / BSIZE);
+	for (bn = max(last + 1, ra->ahead); bn <= end; bn++) {
+		if ((addr = fs1_bmaplookup(ip, bn)) != 0)
+			breada(ip->dev, addr);
+	}
+	if (end + 1 > ra->ahead)
+		ra->ahead = end + 1;
+}
+
 // Read data from inode.
 int fs1_readi(struct inode* ip, char* dst, uint off, uint n){
 	uint tot, m;
@@ -350,6 +413,169 @@ int fs1_readi(struct inode* ip, char* dst, uint off, uint n){
 	return n;
 }
 
+// O_DIRECT: blocks move between the disk and user memory with one
+// command per run of consecutive sectors, up to BLK_MAXSECTORS,
+// whose PRDT entries point at the user pages. A block goes through
+// the cache instead when it is partial, or when bbypass() says the
+// cache holds it.
+
+// Append user memory [va, va+n) to sg, one piece per stretch of
+// contiguous pages. Returns the new count, or -1 with sg unchanged
+// if it needs more than max pieces or isn't mapped.
+static int fs1_usg(struct sata_sg* sg, int nsg, int max, char* va, uint n){
+	uint32 lastlen = nsg > 0 ? sg[nsg - 1].len : 0;
+	int nsg0 = nsg;
+	uint8* ka;
+	uint m;
+
+	for (; n > 0; n -= m, va += m) {
+		if ((ka = (uint8*)uva2ka(proc->pgdir, va)) == 0)
+			goto bad;
+		ka += (uintp)va % PGSIZE;
+		m = min(n, PGSIZE - (uintp)va % PGSIZE);
+		if (nsg > 0 && sg[nsg - 1].addr + sg[nsg - 1].len == ka)
+			sg[nsg - 1].len += m;
+		else if (nsg == max)
+			goto bad;
+		else {
+			sg[nsg].addr = ka;
+			sg[nsg].len = m;
+			nsg++;
+		}
+	}
+	return nsg;
+
+bad:
+	if (nsg0 > 0)
+		sg[nsg0 - 1].len = lastlen;
+	return -1;
+}
+
+// A run of sectors being gathered for one direct command.
+struct fs1_run {
+	uint dev;
+	int write;
+	uint start;  // first sector
+	uint nsec;
+	int nsg;
+	struct sata_sg sg[BLK_MAXBUFS];
+};
+
+static void fs1_runflush(struct fs1_run* r){
+	if (r->nsec > 0)
+		blkdirect(r->dev, r->start, r->sg, r->nsg, r->write);
+	r->nsec = 0;
+	r->nsg = 0;
+}
+
+// Add block addr, to or from user memory at va, to the run,
+// sending the run first if addr doesn't continue it. Returns
+// 0 if the block has to go through the cache.
+static int fs1_runadd(struct fs1_run* r, uint addr, char* va){
+	int nsg;
+
+	if (r->nsec > 0 && (addr != r->start + r->nsec || r->nsec == BLK_MAXSECTORS))
+		fs1_runflush(r);
+	if (!bbypass(r->dev, addr, r->write))
+		return 0;
+	if ((nsg = fs1_usg(r->sg, r->nsg, BLK_MAXBUFS, va, BSIZE)) < 0 && r->nsec > 0) {
+		fs1_runflush(r);
+		nsg = fs1_usg(r->sg, 0, BLK_MAXBUFS, va, BSIZE);
+	}
+	if (nsg < 0)
+		return 0;
+	if (r->nsec == 0)
+		r->start = addr;
+	r->nsec++;
+	r->nsg = nsg;
+	return 1;
+}
+
+// Read data from inode straight into user memory at dst.
+// Returns -1 if the device can't, or off or dst is misaligned.
+int fs1_readdirect(struct inode* ip, char* dst, uint off, uint n){
+	struct fs1_run r;
+	uint tot, m, addr;
+	struct buf* bp;
+
+	if (off % BSIZE || (uintp)dst % 2 || !blkdma(ip->dev))
+		return -1;
+	if (off > ip->size || off + n < off)
+		return -1;
+	if (off + n > ip->size)
+		n = ip->size - off;
+
+	r.dev = ip->dev;
+	r.write = 0;
+	r.nsec = r.nsg = 0;
+	for (tot = 0; tot < n; tot += m, off += m, dst += m) {
+		m = min(n - tot, BSIZE);
+		addr = fs1_bmap(ip, off / BSIZE);
+		if (m == BSIZE && fs1_runadd(&r, addr, dst))
+			continue;
+		bp = bread(ip->dev, addr);
+		memmove(dst, bp->data, m);
+		brelse(bp);
+	}
+	fs1_runflush(&r);
+	return n;
+}
+
+// Write data to inode straight from user memory at src, like
+// fs1_readdirect. Only block allocation is logged, so this may
+// write less than n: it stops before the blocks that went through
+// the cache would overflow the transaction.
+int fs1_writedirect(struct inode* ip, char* src, uint off, uint n){
+	struct fs1_run r;
+	uint tot, m, addr;
+	struct buf* bp;
+	int logged, direct;
+
+	if (off % BSIZE || (uintp)src % 2 || !blkdma(ip->dev))
+		return -1;
+	if (off > ip->size || off + n < off)
+		return -1;
+	if (off + n > MAXFILE * BSIZE)
+		return -1;
+
+	r.dev = ip->dev;
+	r.write = 1;
+	r.nsec = r.nsg = 0;
+	logged = direct = 0;
+	for (tot = 0; tot < n; tot += m, off += m, src += m) {
+		m = min(n - tot, BSIZE);
+		// Leave room for the inode, the indirect block and two
+		// bitmap blocks. Stop before allocating: a block left
+		// unwritten must not stay mapped without being zeroed.
+		if (logged == MAXOPBLOCKS - 4)
+			break;
+		// A new block written whole needs no zeroing: its data is on
+		// disk before the transaction allocating it commits, either
+		// directly or through the cache below.
+		addr = fs1_bmapalloc(ip, off / BSIZE, m < BSIZE);
+		if (m == BSIZE && fs1_runadd(&r, addr, src)) {
+			direct++;
+			continue;
+		}
+		bp = bread(ip->dev, addr);
+		memmove(bp->data, src, m);
+		log_write(bp);
+		brelse(bp);
+		logged++;
+	}
+	fs1_runflush(&r);
+	if (direct > 0)
+		ip->dwrites++;
+	if (tot > 0)
+		ip->lsn = logseq();
+
+	if (tot > 0 && off > ip->size) {
+		ip->size = off;
+		iupdate(ip);
+	}
+	return tot;
+}
+
 // Write data to inode.
 int fs1_writei(struct inode* ip, char* src, uint off, uint n){
 	uint tot, m;
@@ -367,6 +593,8 @@ int fs1_writei(struct inode* ip, char* src, uint off, uint n){
 		log_write(bp);
 		brelse(bp);
 	}
+	if (n > 0)
+		ip->lsn = logseq();
 
 	if (n > 0 && off > ip->size) {
 		ip->size = off;
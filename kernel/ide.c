@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver. Transfers use PCI bus-master DMA when the controller
+// and drive support it, else PIO.
 
 #include "types.h"
 #include "defs.h"
@@ -10,14 +11,45 @@
 #include "irq.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "kernel/string.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
+#define IDE_DRQ       0x08
 #define IDE_ERR       0x01
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_FLUSH  0xe7
+#define IDE_CMD_RDDMA  0xc8
+#define IDE_CMD_WRDMA  0xca
+#define IDE_CMD_IDENTIFY 0xec
+
+// Bus-master IDE registers, per channel at an offset from BAR4.
+#define BM_CMD       0
+#define BM_STATUS    2
+#define BM_PRDT      4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ  0x08  // device to memory
+#define BM_ST_ERR    0x02
+#define BM_ST_INTR   0x04
+
+// Physical region descriptor: the DMA engine moves count bytes
+// (0 means 64K) at addr, which may not cross a 64K boundary.
+struct prd {
+	uint32 addr;
+	uint16 count;
+	uint16 flags;
+};
+#define PRD_EOT   0x8000  // last entry of the table
+#define PRD_ALIGN 0x10000
+#define NPRD      (PGSIZE / sizeof(struct prd))
+
+#define IDE_MULT      8    // sectors per interrupt in multiple mode
 
 #define PRIMARY_IDE_CHANNEL_BASE   0x1F0
 #define PRIMARY_IDE_INTERRUPT      0x3F6
@@ -37,19 +69,141 @@ uint16 ideChannel = SECONDARY_IDE_CHANNEL_BASE;
 
 static int havedisk0;
 static int havedisk1;
+static int idemult[2];  // sectors per DRQ block for each drive, 0 if single
+static uint idetotal;   // sectors in the request at idequeue
+static uint idedone;    // sectors of it transferred so far
+static uint32 idebmbase;  // bus-master registers found by pci.c
+static uint16 idebm;      // those of ideChannel, 0 for PIO only
+static struct prd* ideprd; // PRD table, a page
+static int idedma[2];     // drive does DMA
+static int idedmaactive;  // request at idequeue is a DMA transfer
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
 static int idewait(int checkerr){
 	int r;
 
-	while (((r = inb(PRIMARY_IDE_CHANNEL_BASE + 7)) & (IDE_BSY | IDE_DRDY)) != IDE_DRDY)
+	while (((r = inb(ideChannel + 7)) & (IDE_BSY | IDE_DRDY)) != IDE_DRDY)
 		;
 	if (checkerr && (r & (IDE_DF | IDE_ERR)) != 0)
 		return -1;
 	return 0;
 }
 
+// Ask drive to move IDE_MULT sectors per interrupt, so that a
+// whole block costs one interrupt instead of one per sector.
+// Drives that refuse keep single-sector transfers.
+static void idesetmult(int drive){
+	int i, r;
+
+	amd64_out8(ideChannel + 6, drive ? IDE_SLAVE : IDE_MASTER);
+	r = inb(ideChannel + 7);
+	if (r == 0 || r == 0xff)
+		return;
+	amd64_out8(ideChannel + 2, IDE_MULT);
+	amd64_out8(ideChannel + 7, IDE_CMD_SETMUL);
+	for (i = 0; i < 100000; i++) {
+		r = inb(ideChannel + 7);
+		if (!(r & IDE_BSY))
+			break;
+	}
+	if (!(r & (IDE_BSY | IDE_DF | IDE_ERR)))
+		idemult[drive] = IDE_MULT;
+}
+
+// Number of sectors moved in the next DRQ block of b.
+static uint idechunk(struct buf* b){
+	uint left = idetotal - idedone;
+	uint mult = idemult[b->dev == 1];
+
+	if (mult == 0)
+		return 1;
+	return left < mult ? left : mult;
+}
+
+// Move the next n sectors of the request at b, which the block
+// layer may have merged from several buffers chained by mnext.
+static void idexfer(struct buf* b, uint n){
+	uint off = idedone * 512;
+
+	idedone += n;
+	for (; n > 0; n--, off += 512) {
+		while (off >= b->size) {
+			off -= b->size;
+			b = b->mnext;
+		}
+		if (b->flags & B_DIRTY)
+			amd64_outsl(ideChannel, b->data + off, 512 / 4);
+		else
+			amd64_insl(ideChannel, b->data + off, 512 / 4);
+	}
+}
+
+// Record the bus-master registers of the PCI IDE controller.
+void idepciattach(uint32 bmbase){
+	if (idebmbase == 0)
+		idebmbase = bmbase;
+}
+
+// Whether drive can do DMA, from its IDENTIFY data
+// (word 49 bit 8). ATAPI and absent drives can't.
+static int ideidentdma(int drive){
+	uint16 id[256];
+	int i, r;
+
+	amd64_out8(ideChannel + 6, drive ? IDE_SLAVE : IDE_MASTER);
+	r = inb(ideChannel + 7);
+	if (r == 0 || r == 0xff)
+		return 0;
+	amd64_out8(ideChannel + 7, IDE_CMD_IDENTIFY);
+	for (i = 0; i < 100000; i++) {
+		r = inb(ideChannel + 7);
+		if (!(r & IDE_BSY) && (r & (IDE_ERR | IDE_DRQ)))
+			break;
+	}
+	if ((r & (IDE_BSY | IDE_ERR | IDE_DF)) || !(r & IDE_DRQ))
+		return 0;
+	amd64_insl(ideChannel, id, sizeof(id) / 4);
+	return (id[49] & (1 << 8)) != 0;
+}
+
+// Set up DMA if pci.c found a bus-master controller.
+static void idedmainit(void){
+	if (idebmbase == 0 || (ideprd = (struct prd*)kalloc()) == 0)
+		return;
+	idebm = idebmbase + (ideChannel == PRIMARY_IDE_CHANNEL_BASE ? 0 : 8);
+	idedma[0] = ideidentdma(0);
+	idedma[1] = havedisk1 && ideidentdma(1);
+	if (idedma[0] || idedma[1])
+		cprintf("   IDE bus-master DMA at 0x%x\n", idebm);
+}
+
+// Fill the PRD table for the request at b.
+// Returns 0 if it doesn't fit.
+static int ideprdfill(struct buf* b){
+	uintp addr;
+	uint len, n;
+	int i;
+
+	i = 0;
+	for (; b; b = b->mnext) {
+		addr = V2P(b->data);
+		for (len = b->size; len > 0; len -= n, addr += n) {
+			n = PRD_ALIGN - (addr & (PRD_ALIGN - 1));
+			if (n > len)
+				n = len;
+			if (i == NPRD)
+				return 0;
+			ideprd[i].addr = addr;
+			ideprd[i].count = n & 0xffff;
+			ideprd[i].flags = 0;
+			i++;
+		}
+	}
+	ideprd[i - 1].flags = PRD_EOT;
+	return 1;
+}
+
 void ideinit(void){
 	int i;
 
@@ -81,33 +235,74 @@ void ideinit(void){
 		cprintf("   no IDE devices detected\n");
 	}
 
+	idesetmult(0);
+	if(havedisk1)
+		idesetmult(1);
+	idedmainit();
+
 	// Switch back to disk 0.
 	amd64_out8(ideChannel + 6, IDE_MASTER);
 }
 
 // Start the request for b.  Caller must hold idelock.
+// The whole request goes out as one command; ideintr moves
+// the data a DRQ block at a time.
 static void idestart(struct buf* b){
+	struct buf* p;
+	int mult, dir = 0;
+
 	if (b == 0)
 		panic("idestart");
 
+	idedmaactive = 0;
+	if (b->flags & B_FLUSH) {
+		idetotal = idedone = 0;
+		idewait(0);
+		amd64_out8((ideChannel == PRIMARY_IDE_CHANNEL_BASE ? PRIMARY_IDE_INTERRUPT : SECONDARY_IDE_INTERRUPT), 0); // generate interrupt
+		amd64_out8(ideChannel + 6, b->dev == 1 ? IDE_SLAVE : IDE_MASTER);
+		amd64_out8(ideChannel + 7, IDE_CMD_FLUSH);
+		return;
+	}
+
+	mult = idemult[b->dev == 1];
+	idedone = 0;
+	idetotal = 0;
+	for (p = b; p; p = p->mnext)
+		idetotal += p->size / 512;
+	if (idetotal > 256)
+		panic("idestart: request too long");
+	if (idedma[b->dev == 1] && ideprdfill(b)) {
+		// Load the PRD table and direction before the command,
+		// start the engine after it; ideintr stops it.
+		idedmaactive = 1;
+		dir = (b->flags & B_DIRTY) ? 0 : BM_CMD_READ;
+		amd64_out8(idebm + BM_CMD, 0);
+		amd64_out32(idebm + BM_PRDT, V2P(ideprd));
+		amd64_out8(idebm + BM_STATUS, BM_ST_ERR | BM_ST_INTR); // clear
+		amd64_out8(idebm + BM_CMD, dir);
+	}
 	idewait(0);
 	amd64_out8((ideChannel == PRIMARY_IDE_CHANNEL_BASE ? PRIMARY_IDE_INTERRUPT : SECONDARY_IDE_INTERRUPT), 0); // generate interrupt
-	amd64_out8(ideChannel + 2, 1); // number of sectors
+	amd64_out8(ideChannel + 2, idetotal & 0xff); // number of sectors, 0 means 256
 	amd64_out8(ideChannel + 3, b->sector & 0xff);
 	amd64_out8(ideChannel + 4, (b->sector >> 8) & 0xff);
 	amd64_out8(ideChannel + 5, (b->sector >> 16) & 0xff);
 	amd64_out8(ideChannel + 6, (b->dev == 1 ? IDE_SLAVE : IDE_MASTER) | ((b->sector >> 24) & 0x0f));
-	if (b->flags & B_DIRTY) {
-		amd64_out8(ideChannel + 7, IDE_CMD_WRITE);
-		amd64_outsl(ideChannel, b->data, 512 / 4);
+	if (idedmaactive) {
+		amd64_out8(ideChannel + 7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+		amd64_out8(idebm + BM_CMD, dir | BM_CMD_START);
+	} else if (b->flags & B_DIRTY) {
+		amd64_out8(ideChannel + 7, mult ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+		idexfer(b, idechunk(b));
 	} else {
-		amd64_out8(ideChannel + 7, IDE_CMD_READ);
+		amd64_out8(ideChannel + 7, mult ? IDE_CMD_RDMUL : IDE_CMD_READ);
 	}
 }
 
 // Interrupt handler.
 void ideintr(void){
-	struct buf* b;
+	struct buf* b, * p;
+	int st, r;
 
 	// First queued buffer is the active request.
 	acquire(&idelock);
@@ -116,15 +311,51 @@ void ideintr(void){
 		// cprintf("spurious IDE interrupt\n");
 		return;
 	}
-	idequeue = b->qnext;
 
-	// Read data if needed.
-	if (!(b->flags & B_DIRTY) && idewait(1) >= 0)
-		amd64_insl(ideChannel, b->data, 512 / 4);
+	// Move the next DRQ block; the drive interrupts again
+	// until every sector of the request has been transferred.
+	// A DMA transfer interrupts once, when it is done.
+	if (idedmaactive) {
+		st = inb(idebm + BM_STATUS);
+		if (!(st & BM_ST_INTR)) {
+			release(&idelock);
+			return;
+		}
+		amd64_out8(idebm + BM_CMD, 0);
+		amd64_out8(idebm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+		r = inb(ideChannel + 7); // also acknowledges the drive
+		if ((st & BM_ST_ERR) || (r & (IDE_DF | IDE_ERR))) {
+			// Retry the request by PIO, and keep to it.
+			cprintf("ide: DMA error on disk %d, using PIO\n", b->dev);
+			idedma[b->dev == 1] = 0;
+			idestart(b);
+			release(&idelock);
+			return;
+		}
+		idedone = idetotal;
+	} else if (b->flags & B_FLUSH) {
+		// No data; the interrupt means the cache is written.
+	} else if (!(b->flags & B_DIRTY)) {
+		if (idewait(1) >= 0)
+			idexfer(b, idechunk(b));
+		else
+			idedone = idetotal;
+	} else if (idedone < idetotal) {
+		idexfer(b, idechunk(b));
+		release(&idelock);
+		return;
+	}
+	if (idedone < idetotal) {
+		release(&idelock);
+		return;
+	}
+	idequeue = b->qnext;
 
-	// Wake process waiting for this buf.
-	b->flags |= B_VALID;
-	b->flags &= ~B_DIRTY;
+	// Wake process waiting for this request.
+	for (p = b; p; p = p->mnext) {
+		p->flags |= B_VALID;
+		p->flags &= ~B_DIRTY;
+	}
 	wakeup(b);
 
 	// Start disk on next buf in queue.
@@ -134,13 +365,28 @@ void ideintr(void){
 	release(&idelock);
 }
 
-// Sync buf with disk.
+// Write drive dev's volatile cache to the media. Goes through
+// idequeue as a request without data, so it covers the requests
+// completed before it.
+void ideflush(uint dev){
+	struct buf b;
+
+	if (dev != 0 && !havedisk1)
+		panic("ideflush: ide disk 1 not present");
+	memset(&b, 0, sizeof(b));
+	b.dev = dev;
+	b.flags = B_FLUSH | B_DIRTY | B_INFLIGHT;
+	iderw(&b);
+}
+
+// Sync buf with disk, along with any buffers the block layer
+// chained to it through mnext.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void iderw(struct buf* b){
 	struct buf** pp;
 
-	if (!(b->flags & B_BUSY))
+	if (!(b->flags & B_INFLIGHT))
 		panic("iderw: buf not busy");
 	if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
 		panic("iderw: nothing to do");
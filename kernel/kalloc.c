@@ -8,6 +8,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "x86.h"
+#include "proc.h"
 #include "kernel/string.h"
 
 void freerange(void* vstart, void* vend);
@@ -21,6 +23,7 @@ struct {
 	struct spinlock lock;
 	int use_lock;
 	struct run* freelist;
+	uint nfree;       // pages on freelist
 } kmem;
 
 int kalloc_fullysetup = 0;
@@ -74,6 +77,7 @@ void kfree(char* v){
 	r = (struct run*)v;
 	r->next = kmem.freelist;
 	kmem.freelist = r;
+	kmem.nfree++;
 	if (kmem.use_lock)
 		release(&kmem.lock);
 }
@@ -83,34 +87,57 @@ void kfree(char* v){
 // Returns 0 if the memory cannot be allocated.
 char* kalloc(void){
 	struct run* r;
+	int reclaimed = 0;
 
+again:
 	if (kmem.use_lock)
 		acquire(&kmem.lock);
 	r = kmem.freelist;
-	if (r)
+	if (r) {
 		kmem.freelist = r->next;
+		kmem.nfree--;
+	}
 	if (kmem.use_lock)
 		release(&kmem.lock);
+
+	// Out of memory: take some back from the buffer cache. Only
+	// when no spinlocks are held, since that takes bcache locks.
+	if (r == 0 && !reclaimed && kalloc_fullysetup && cpu->ncli == 0) {
+		reclaimed = 1;
+		if (bshrink(KALLOC_RECLAIM) > 0)
+			goto again;
+	}
 	return (char*)r;
 }
 
+// Number of free pages.
+uint kfreepages(void){
+	return kmem.nfree;
+}
+
+// Allocate pages contiguous pages of physical memory. Looks for
+// a run of them on the free list: pages freed in address order,
+// as freerange() does, sit there highest first.
+// Returns the lowest page, or 0 if there is no such run.
 char *kmalloc(uint16 pages){
-	if(!kalloc_fullysetup) {
-		panic("kalloc not fully setup");
-	}
-	struct run* r;
+	struct run** pp, * r, * last;
+	uint16 n;
 
+	if (pages == 0)
+		return 0;
 	if (kmem.use_lock)
 		acquire(&kmem.lock);
-	r = kmem.freelist;
-	if (r) {
-		struct run* n = r->next;
-		for(uint8 i = 0; i != pages; i++) {
-			kmem.freelist = n;
-			n = n->next;
+	for (pp = &kmem.freelist; (r = *pp) != 0; pp = &r->next) {
+		last = r;
+		for (n = 1; n < pages && last->next == (struct run*)((char*)last - PGSIZE); n++)
+			last = last->next;
+		if (n == pages) {
+			*pp = last->next;
+			kmem.nfree -= pages;
+			break;
 		}
 	}
 	if (kmem.use_lock)
 		release(&kmem.lock);
-	return (char*)r;
+	return r ? (char*)last : 0;
 }
@@ -40,13 +40,38 @@
 #define TCCR    (0x0390 / 4)   // Timer Current Count
 #define TDCR    (0x03E0 / 4)   // Timer Divide Configuration
 
+#define CALIBRATE_MS  50        // length of the PIT interval used for calibration
+
 volatile uint* lapic;  // Initialized in mp.c
+static uint lapictimercount;  // timer counts per tick, set by lapiccalibrate()
 
 static void lapicw(int index, int value){
 	lapic[index] = value;
 	lapic[ID]; // wait for write to finish, by reading
 }
 
+// Count how far the LAPIC timer and the TSC advance during a known
+// PIT interval, so the timer fires HZ times per second whatever the
+// bus speed, and the TSC can serve as a nanosecond clock.
+static void lapiccalibrate(void){
+	uint64 tsc0, tsc1, counted;
+
+	lapicw(TDCR, X1);
+	lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+	pitdelaystart(CALIBRATE_MS);
+	tsc0 = amd64_rdtsc();
+	lapicw(TICR, 0xFFFFFFFF);
+	pitdelaywait();
+	counted = 0xFFFFFFFF - lapic[TCCR];
+	tsc1 = amd64_rdtsc();
+	lapicw(TICR, 0);
+
+	lapictimercount = counted * 1000 / (CALIBRATE_MS * HZ);
+	if (lapictimercount == 0)
+		lapictimercount = 10000000; // no usable PIT; old uncalibrated default
+	tscinit((tsc1 - tsc0) * 1000 / CALIBRATE_MS);
+}
+
 void lapicinit(void){
 	if (!lapic)
 		return;
@@ -56,11 +81,13 @@ void lapicinit(void){
 
 	// The timer repeatedly counts down at bus frequency
 	// from lapic[TICR] and then issues an interrupt.
-	// If xv6 cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// The boot CPU calibrates TICR against the PIT; the
+	// others reuse its result.
+	if (lapictimercount == 0)
+		lapiccalibrate();
 	lapicw(TDCR, X1);
 	lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-	lapicw(TICR, 10000000);
+	lapicw(TICR, lapictimercount);
 
 	// Disable logical interrupt lines.
 	lapicw(LINT0, MASKED);
@@ -91,6 +118,45 @@ void lapicinit(void){
 	lapicw(TPR, 0);
 }
 
+// Program this CPU's timer. TICK_PERIODIC interrupts HZ times a
+// second, TICK_ONESHOT interrupts once after n ticks and TICK_STOPPED
+// not at all. Must be called with interrupts disabled.
+void lapicsettimer(int mode, uint n){
+	uint64 count;
+
+	if (!lapic || (mode == TICK_PERIODIC && cpu->tickmode == TICK_PERIODIC))
+		return;
+
+	cpu->tickmode = mode;
+	switch (mode) {
+	case TICK_PERIODIC:
+		lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+		lapicw(TICR, lapictimercount);
+		break;
+	case TICK_ONESHOT:
+		count = (uint64)lapictimercount * n;
+		if (count > 0xFFFFFFFF)
+			count = 0xFFFFFFFF;
+		lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+		lapicw(TICR, count);
+		break;
+	default:
+		lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+		lapicw(TICR, 0);
+	}
+}
+
+// Send interrupt vector to the CPU with the given APIC id.
+// Must be called with interrupts disabled.
+void lapicipi(uchar apicid, int vector){
+	if (!lapic)
+		return;
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, FIXED | vector);
+	while (lapic[ICRLO] & DELIVS)
+		;
+}
+
 // This is only used during secondary processor startup.
 // cpu->id is the fast way to get the cpu number, once the
 // processor is fully started.
@@ -126,8 +192,15 @@ void lapiceoi(void){
 }
 
 // Spin for a given number of microseconds.
-// On real hardware would want to tune this dynamically.
+// Does nothing until the TSC has been calibrated.
 void microdelay(int us){
+	uint64 end;
+
+	if (tscfreq() == 0)
+		return;
+	end = nsecs() + (uint64)us * 1000;
+	while (nsecs() < end)
+		amd64_pause();
 }
 
 #define IO_RTC  0x70
@@ -20,7 +20,13 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the flusher has emptied the log.
+//
+// Commits are pipelined: once the last outstanding end_op() has
+// copied the transaction's blocks into log buffers, a new
+// transaction opens while the copies are written out, and
+// whatever it has gathered when the first commit is done is
+// committed by the same process right after (group commit).
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -29,7 +35,24 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The blocks of one commit sit in consecutive log slots and are
+// written together, so the block layer sends them as one request.
+//
+// The disk may cache writes, so the log orders them itself: the
+// log blocks are flushed before the header that commits them is
+// written, home locations are flushed before the header that lets
+// go of them, and header writes are FUA, so a transaction is
+// durable when its commit returns.
+//
+// Committing only appends to the log: end_op() returns once the
+// transaction's blocks and the header are on disk, and the blocks
+// stay dirty in the buffer cache. Later transactions are appended
+// after it; a block changed again gets a new slot, since the copy
+// in the log belongs to a committed transaction. The logflush
+// thread writes the cached blocks home and empties the log
+// (a checkpoint) when the oldest commit is LOG_FLUSH_AGE ticks old,
+// when the log is LOG_DIRTY_RATIO percent full, or when asked to by
+// begin_op() or logsync(). logforce() waits for a commit.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged sector #s before commit.
@@ -43,15 +66,40 @@ struct log {
 	int start;
 	int size;
 	int outstanding; // how many FS sys calls are executing.
-	int committing; // in commit(), please wait.
+	int committing; // a commit is being written
+	int sealing;    // commit() is copying blocks, please wait.
+	int flushing;   // in checkpoint(), please wait.
+	int flushreq;   // a checkpoint is wanted now
+	int forcing;    // processes in logforce()
 	int dev;
+	int committed;  // lh.sector[0..committed) are committed
+	int sealed;     // lh.sector[0..sealed) are committed or being committed
+	uint open;      // the transaction FS system calls join
+	uint committime; // ticks at the oldest commit not yet checkpointed
+	uint seq;       // transactions committed so far
+	uint nflush;    // checkpoints done so far
 	struct logheader lh;
 };
 
 struct log log;
 extern uint64 ROOT_DEV;
 static void recover_from_log(void);
-static void commit();
+static void commit(uint);
+static void logflush(void*);
+
+// Buffers being written by write_log() or install_trans(),
+// held locked until their writes complete.
+static struct buf* logbuf[LOGSIZE];
+
+// Wait for the writes of the first n logbuf[] and release them.
+static void logbufwait(int n){
+	int i;
+
+	for (i = 0; i < n; i++) {
+		blkwait(logbuf[i]);
+		brelse(logbuf[i]);
+	}
+}
 
 void initlog(void){
 	if (sizeof(struct logheader) >= BSIZE)
@@ -69,23 +117,62 @@ void initlog(void){
 		fs1_readsb(ROOT_DEV, &sb);
 		log.start = sb.size - sb.nlog;
 		log.size = sb.nlog;
+		// begin_op() reserves MAXOPBLOCKS per operation; a smaller
+		// log, as older images have, could never admit one.
+		if (log.size < MAXOPBLOCKS + 1)
+			panic("initlog: log smaller than MAXOPBLOCKS+1, remake fs.img");
 	}
 	log.dev = ROOT_DEV;
 	recover_from_log();
+	kthread("logflush", logflush, 0);
+}
+
+// Whether log slot i is overwritten by a later slot for the same sector.
+static int superseded(int i){
+	int j;
+
+	for (j = i + 1; j < log.lh.n; j++)
+		if (log.lh.sector[j] == log.lh.sector[i])
+			return 1;
+	return 0;
 }
 
 // Copy committed blocks from log to their home location
 static void install_trans(void){
-	int tail;
+	int tail, n;
 
-	for (tail = 0; tail < log.lh.n; tail++) {
+	blkplug(log.dev);
+	for (n = 0, tail = 0; tail < log.lh.n; tail++) {
+		if (superseded(tail))
+			continue;
 		struct buf* lbuf = bread(log.dev, log.start + tail + 1); // read log block
 		struct buf* dbuf = bread(log.dev, log.lh.sector[tail]); // read dst
 		memmove(dbuf->data, lbuf->data, BSIZE); // copy block to dst
-		bwrite(dbuf); // write dst to disk
 		brelse(lbuf);
-		brelse(dbuf);
+		dbuf->flags |= B_DIRTY;
+		blksubmit(dbuf); // write dst to disk
+		logbuf[n++] = dbuf;
+	}
+	blkunplug(log.dev);
+	logbufwait(n);
+}
+
+// Write the committed blocks home from the buffer cache, where they
+// are pinned dirty and hold the newest committed contents.
+static void checkpoint_trans(void){
+	int tail, n;
+
+	blkplug(log.dev);
+	for (n = 0, tail = 0; tail < log.lh.n; tail++) {
+		if (superseded(tail))
+			continue;
+		struct buf* dbuf = bread(log.dev, log.lh.sector[tail]);
+		dbuf->flags |= B_DIRTY;
+		blksubmit(dbuf);
+		logbuf[n++] = dbuf;
 	}
+	blkunplug(log.dev);
+	logbufwait(n);
 }
 
 // Read the log header from disk into the in-memory log header
@@ -100,17 +187,18 @@ static void read_head(void){
 	brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write the first n in-memory log header entries to disk.
 // This is the true point at which the
 // current transaction commits.
-static void write_head(void){
-	struct buf* buf = bread(log.dev, log.start);
+static void write_head(int n){
+	struct buf* buf = bgetblk(log.dev, log.start);
 	struct logheader* hb = (struct logheader*)(buf->data);
 	int i;
-	hb->n = log.lh.n;
-	for (i = 0; i < log.lh.n; i++) {
+	hb->n = n;
+	for (i = 0; i < n; i++) {
 		hb->sector[i] = log.lh.sector[i];
 	}
+	buf->flags |= B_FUA;
 	bwrite(buf);
 	brelse(buf);
 }
@@ -118,18 +206,39 @@ static void write_head(void){
 static void recover_from_log(void){
 	read_head();
 	install_trans(); // if committed, copy from log to disk
+	blkflush(log.dev);
 	log.lh.n = 0;
-	write_head(); // clear the log
+	write_head(0); // clear the log
+	log.open = 1;
+}
+
+// Log slots usable for blocks, after the header.
+// An ext2 root has no log at all; initlog() made sure that any
+// other log holds at least one operation.
+static int logcap(void){
+	if (log.size == 0 || log.size - 1 > LOGSIZE)
+		return LOGSIZE;
+	return log.size - 1;
+}
+
+// Wake the flusher for a checkpoint. Caller holds log.lock.
+static void wantflush(void){
+	log.flushreq = 1;
+	wakeup(&log.flushreq);
 }
 
 // called at the start of each FS system call.
 void begin_op(void){
 	acquire(&log.lock);
 	while (1) {
-		if (log.committing) {
+		if (log.sealing || log.flushing || log.flushreq) {
+			sleep(&log, &log.lock);
+		} else if (log.forcing && log.outstanding > 0) {
+			// let the running ops finish so that logforce() sees a commit.
 			sleep(&log, &log.lock);
-		} else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
-			// this op might exhaust log space; wait for commit.
+		} else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > logcap()) {
+			// this op might exhaust log space; wait for a checkpoint.
+			wantflush();
 			sleep(&log, &log.lock);
 		} else {
 			log.outstanding += 1;
@@ -139,62 +248,197 @@ void begin_op(void){
 	}
 }
 
+// Commit the open transaction, then the ones that gather while
+// that commit runs, until none is left to commit. Caller holds
+// log.lock and has set log.committing.
+static void group_commit(void){
+	uint seq;
+
+	for (;;) {
+		// Seal the transaction while no FS system call is in it.
+		seq = log.open++;
+		log.sealed = log.lh.n;
+		log.sealing = 1;
+		// call commit w/o holding locks, since not allowed
+		// to sleep with locks.
+		release(&log.lock);
+		commit(seq);
+		acquire(&log.lock);
+		if (log.lh.n * 100 >= logcap() * LOG_DIRTY_RATIO)
+			wantflush();
+		wakeup(&log);
+		// Commit the transaction that gathered meanwhile if it is done.
+		if (log.outstanding > 0 || log.lh.n == log.committed) {
+			log.committing = 0;
+			return;
+		}
+	}
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless a commit is under way; that one picks it up.
 void end_op(void){
 	int do_commit = 0;
 
 	acquire(&log.lock);
 	log.outstanding -= 1;
-	if (log.committing)
-		panic("log.committing");
-	if (log.outstanding == 0) {
+	if (log.outstanding == 0 && !log.committing) {
 		do_commit = 1;
 		log.committing = 1;
 	} else {
 		// begin_op() may be waiting for log space.
 		wakeup(&log);
 	}
+
+	if (do_commit)
+		group_commit();
 	release(&log.lock);
+}
 
-	if (do_commit) {
-		// call commit w/o holding locks, since not allowed
-		// to sleep with locks.
-		commit();
-		acquire(&log.lock);
-		log.committing = 0;
-		wakeup(&log);
-		release(&log.lock);
+// The transaction that changes made now will be committed in.
+uint logseq(void){
+	return log.open;
+}
+
+// Wait until transaction seq, from logseq(), is committed.
+void logforce(uint seq){
+	acquire(&log.lock);
+	log.forcing++;
+	while ((int)(log.seq - seq) < 0) {
+		if (seq == log.open && log.outstanding == 0 &&
+		    !log.committing && !log.flushing) {
+			// Every op in seq has ended and none committed it:
+			// it logged nothing after the last commit. Commit
+			// it ourselves; that costs no disk writes.
+			log.committing = 1;
+			group_commit();
+		} else {
+			sleep(&log, &log.lock);
+		}
 	}
+	log.forcing--;
+	wakeup(&log);
+	release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
-static void write_log(void){
+// Wait until everything committed so far is written home.
+// Any checkpoint that ends after the call will do: it waits for
+// the running FS system calls and keeps new ones out.
+void logsync(void){
+	uint n;
+
+	acquire(&log.lock);
+	if (log.lh.n > 0 || log.outstanding > 0) {
+		n = log.nflush;
+		wantflush();
+		while (log.nflush == n)
+			sleep(&log, &log.lock);
+	}
+	release(&log.lock);
+	blkflush(log.dev); // and anything written around the log
+}
+
+// Copy the blocks of the sealed transaction from cache to log
+// buffers, leaving them locked in logbuf[].
+static void copy_log(void){
 	int tail;
 
-	for (tail = 0; tail < log.lh.n; tail++) {
-		struct buf* to = bread(log.dev, log.start + tail + 1); // log block
+	for (tail = log.committed; tail < log.sealed; tail++) {
+		struct buf* to = bgetblk(log.dev, log.start + tail + 1); // log block
 		struct buf* from = bread(log.dev, log.lh.sector[tail]); // cache block
 		memmove(to->data, from->data, BSIZE);
-		bwrite(to); // write the log
 		brelse(from);
-		brelse(to);
+		logbuf[tail - log.committed] = to;
 	}
 }
 
-static void commit(){
+// Write the log buffers filled by copy_log() as one request.
+static void write_log(void){
+	int tail;
+
+	blkplug(log.dev);
+	for (tail = log.committed; tail < log.sealed; tail++) {
+		logbuf[tail - log.committed]->flags |= B_DIRTY;
+		blksubmit(logbuf[tail - log.committed]); // write the log
+	}
+	blkunplug(log.dev);
+	logbufwait(log.sealed - log.committed);
+}
+
+// Append sealed transaction seq to the log. Its blocks stay dirty
+// in the cache until the flusher writes them home. New FS system
+// calls wait only while the blocks are copied; they start the next
+// transaction, whose blocks go after log.sealed.
+static void commit(uint seq){
+	copy_log();
+	acquire(&log.lock);
+	log.sealing = 0;
+	wakeup(&log);
+	release(&log.lock);
+
+	if (log.sealed > log.committed) {
+		write_log(); // Write modified blocks to log
+		blkflush(log.dev); // before the header points at them
+		write_head(log.sealed); // Write header to disk -- the real commit
+	}
+
+	acquire(&log.lock);
+	if (log.committed == 0 && log.sealed > 0)
+		log.committime = ticks;
+	log.committed = log.sealed;
+	log.seq = seq;
+	release(&log.lock);
+}
+
+// Whether the flusher has a checkpoint to do. Caller holds log.lock.
+static int flushdue(void){
+	if (log.flushreq)
+		return 1;
+	return log.committed > 0 && ticks - log.committime >= LOG_FLUSH_AGE;
+}
+
+// Write committed blocks home and empty the log. No FS system
+// calls run meanwhile, so the cache holds just committed contents.
+static void checkpoint(void){
+	acquire(&log.lock);
+	log.flushing = 1;
+	while (log.outstanding > 0 || log.committing)
+		sleep(&log, &log.lock);
+	release(&log.lock);
+
 	if (log.lh.n > 0) {
-		write_log(); // Write modified blocks from cache to log
-		write_head(); // Write header to disk -- the real commit
-		install_trans(); // Now install writes to home locations
+		checkpoint_trans(); // Install writes to home locations
+		blkflush(log.dev); // before the header lets go of them
 		log.lh.n = 0;
-		write_head(); // Erase the transaction from the log
+		log.committed = 0;
+		log.sealed = 0;
+		write_head(0); // Erase the transactions from the log
+	}
+
+	acquire(&log.lock);
+	log.flushing = 0;
+	log.flushreq = 0;
+	log.nflush++;
+	wakeup(&log);
+	release(&log.lock);
+}
+
+// The flusher thread: checkpoint when one is due.
+static void logflush(void* arg){
+	for (;;) {
+		acquire(&log.lock);
+		while (!flushdue())
+			sleeptimeout(&log.flushreq, &log.lock, LOG_FLUSH_AGE);
+		release(&log.lock);
+		checkpoint();
 	}
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will write it to the log and
+// checkpoint() to its home location.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -204,12 +448,13 @@ static void commit(){
 void log_write(struct buf* b){
 	int i;
 
-	if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+	acquire(&log.lock);
+	if (log.lh.n >= logcap())
 		panic("too big a transaction");
 	if (log.outstanding < 1)
 		panic("log_write outside of trans");
 
-	for (i = 0; i < log.lh.n; i++) {
+	for (i = log.sealed; i < log.lh.n; i++) {
 		if (log.lh.sector[i] == b->sector) // log absorbtion
 			break;
 	}
@@ -217,4 +462,5 @@ void log_write(struct buf* b){
 	if (i == log.lh.n)
 		log.lh.n++;
 	b->flags |= B_DIRTY; // prevent eviction
+	release(&log.lock);
 }
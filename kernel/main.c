@@ -8,11 +8,14 @@
 #include "acpi.h"
 #include "pci.h"
 #include "buf.h"
+#include "vdso.h"
 #include "kernel/string.h"
 
 static void identcpu();
 static void credits();
 static void startothers(void);
+static void vdsoinit(void);
+static int kernelinfo(char*, int);
 static void mpmain(void)  __attribute__((noreturn));
 extern pde_t* kpgdir;
 uint64 ROOT_DEV = 1;
@@ -46,11 +49,16 @@ int main(void){
 	consoleinit(); // I/O devices & their interrupts
 	uartinit(); // serial port
 	cprintf("%s CPU detected (%s - %d)\n", CPU_NAME, CPU_VENDOR, CPU_MODEL);
+	cprintf("TSC: %d MHz\n", (uint)(tscfreq() / 1000000));
+	vdsoinit(); // user-visible kernel data page
 	pinit();   // process table
 	procloopinit();// setup proc loop device
+	scstatinit(); // system call statistics device
+	lockstatinit(); // spinlock statistics device
 	tvinit();  // trap vectors
 	pciinit(); // initialize PCI bus (AHCI also)
 	binit();   // buffer cache
+	blkinit(); // block request queues
 	fileinit(); // file table
 	ideinit(); // init IDE disks
 
@@ -60,7 +68,9 @@ int main(void){
 
 	startothers(); // start other processors
 	kinit2(P2V(KALLOC_START + 4 * 1024 * 1024), P2V(PHYSTOP)); // must come after startothers()
+	bsizeinit(); // let the buffer cache use the memory just freed
 	userinit(); // first user process
+	kblockdinit(); // block layer thread
 
 	// Finish setting up this processor in mpmain.
 	mpmain();
@@ -154,13 +164,9 @@ void sys_halt(){
 	halt();
 }
 
-int sys_info(void) {
-	char *buf;
-	int n;
-
-	if (argint(1, &n) < 0 || argptr(0, &buf, n) < 0)
-		return -1;
-
+// Write the kernel description to buf, which holds n bytes.
+// Returns the size of the description including the nul.
+static int kernelinfo(char *buf, int n) {
 	char str[] = "Xv64 0.25 xx-way SMP kernel amd64";
 	int tens = ncpu / 10;
 	int ones = ncpu - (tens * 10);
@@ -168,10 +174,31 @@ int sys_info(void) {
 	str[10] = 48 + tens;
 	str[11] = 48 + ones;
 
-	memcopy(buf, str, sizeof(str));
+	memcopy(buf, str, n < sizeof(str) ? n : sizeof(str));
 	return sizeof(str);
 }
 
+int sys_info(void) {
+	char *buf;
+	int n;
+
+	if (argint(1, &n) < 0 || argptr(0, &buf, n) < 0)
+		return -1;
+
+	return kernelinfo(buf, n);
+}
+
+// Set up the page that mapvdso() shares read-only with every process.
+static void vdsoinit(void) {
+	if ((vdsodata = (struct vdso_data*)kalloc()) == 0)
+		panic("vdsoinit");
+	memset(vdsodata, 0, PGSIZE);
+	vdsodata->hz = HZ;
+	vdsodata->ncpu = ncpu;
+	tscvdso(vdsodata);
+	kernelinfo(vdsodata->info, sizeof(vdsodata->info));
+}
+
 int sys_nprocs() {
 	return ncpu;
 }
@@ -21,32 +21,43 @@ void ideinit(void){
 	disksize = (uint)_binary_fs_img_size / 512;
 }
 
+// No DMA here.
+void idepciattach(uint32 bmbase){
+}
+
 // Interrupt handler.
 void ideintr(void){
 	// no-op
 }
 
-// Sync buf with disk.
+// Memory has no write cache.
+void ideflush(uint dev){
+}
+
+// Sync buf with disk, along with any buffers the block layer
+// chained to it through mnext.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void iderw(struct buf* b){
 	uchar* p;
 
-	if (!(b->flags & B_BUSY))
-		panic("iderw: buf not busy");
-	if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
-		panic("iderw: nothing to do");
-	if (b->dev != 1)
-		panic("iderw: request not for disk 1");
-	if (b->sector >= disksize)
-		panic("iderw: sector out of range");
-
-	p = memdisk + b->sector * 512;
-
-	if (b->flags & B_DIRTY) {
-		b->flags &= ~B_DIRTY;
-		memmove(p, b->data, 512);
-	} else
-		memmove(b->data, p, 512);
-	b->flags |= B_VALID;
+	for (; b; b = b->mnext) {
+		if (!(b->flags & B_INFLIGHT))
+			panic("iderw: buf not busy");
+		if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
+			panic("iderw: nothing to do");
+		if (b->dev != 1)
+			panic("iderw: request not for disk 1");
+		if (b->sector + b->size / 512 > disksize)
+			panic("iderw: sector out of range");
+
+		p = memdisk + b->sector * 512;
+
+		if (b->flags & B_DIRTY) {
+			b->flags &= ~B_DIRTY;
+			memmove(p, b->data, b->size);
+		} else
+			memmove(b->data, p, b->size);
+		b->flags |= B_VALID;
+	}
 }
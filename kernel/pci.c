@@ -81,8 +81,24 @@ static int pci_attach_match(uint32 key1, uint32 key2, struct pci_driver* list, s
 	return 0;
 }
 
+// A PCI IDE controller: hand ide.c the bus-master registers in
+// BAR4 and let the controller master the bus for DMA.
+static void pci_attach_ide(struct pci_func* f){
+	uint32 bar4 = pci_conf_read(f, PCI_BAR4_OFFSET);
+
+	if (PCI_MAPREG_TYPE(bar4) != 1 || PCI_MAPREG_IO_ADDR(bar4) == 0)
+		return;
+	pci_conf_write(f, PCI_COMMAND_STATUS_REG,
+	               pci_conf_read(f, PCI_COMMAND_STATUS_REG) | PCI_CMD_IO_ENABLE | PCI_CMD_MASTER_ENABLE);
+	idepciattach(PCI_MAPREG_IO_ADDR(bar4));
+}
+
 static void pci_attach_storage_dev(struct pci_func* f){
-	ahci_try_setup_device(f->bus->busno, f->dev, f->func);
+	if (PCI_CLASS(f->dev_class) == PCI_DEV_CLASS_STORAGE &&
+	    PCI_SUBCLASS(f->dev_class) == PCI_SUBCLASS_STORAGE_IDE)
+		pci_attach_ide(f);
+	else
+		ahci_try_setup_device(f->bus->busno, f->dev, f->func);
 }
 
 static int pci_fallback_attach(struct pci_func* f){ //TODO: remove in favor of dev class specific functions
@@ -0,0 +1,52 @@
+// Per-CPU data areas; see percpu.h.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "percpu.h"
+#include "kernel/string.h"
+
+__thread char* percpubase;
+char* percpuarea[NCPU];
+
+// Give the running CPU its copy of the .percpu section.
+// Called from seginit() on every CPU once %fs is set up.
+void percpuinit(void){
+	uint64 size = percpu_end - percpu_start;
+	uint64 pages = PGROUNDUP(size) / PGSIZE;
+	char* area;
+
+	if (percpuarea[cpu->id] == 0) {
+		// Pages are page, and so cache line, aligned. Only CPUs
+		// that start get an area, when they start.
+		if ((area = kmalloc(pages)) == 0)
+			panic("percpuinit: out of memory");
+		memset(area, 0, pages * PGSIZE);
+		memmove(area, percpu_start, size);
+		percpuarea[cpu->id] = area;
+	}
+	percpubase = percpuarea[cpu->id];
+}
+
+// Add n to the running CPU's copy of counter c.
+void pcounteradd(struct pcounter* c, int64 n){
+	pushcli();
+	THISCPU(*c)->count += n;
+	popcli();
+}
+
+// Sum counter c over all CPUs. Other CPUs may be adding
+// meanwhile, so the result is only a snapshot.
+int64 pcountersum(struct pcounter* c){
+	int64 sum = 0;
+	int i;
+
+	for (i = 0; i < ncpu; i++)
+		if (percpuarea[i])
+			sum += PERCPU(*c, i)->count;
+	return sum;
+}
@@ -68,6 +68,7 @@ void pipeclose(struct pipe* p, int writable){
 	}
 	if (p->readopen == 0 && p->writeopen == 0) {
 		release(&p->lock);
+		destroylock(&p->lock);
 		kfree((char*)p);
 	} else
 		release(&p->lock);
@@ -9,6 +9,8 @@
 #include "kernel/string.h"
 #include "vfs.h"
 #include "file.h"
+#include "irq.h"
+#include "vdso.h"
 
 struct ptable_node {
     struct proc proc;
@@ -18,8 +20,24 @@ struct ptable_node {
 struct {
 	struct spinlock lock;
 	struct ptable_node *head;
+	volatile int nrunnable;  // RUNNABLE processes not yet picked up by a CPU
 } ptable;
 
+// Hierarchical timer wheel holding processes in a timed sleep, protected
+// by ptable.lock. Level 0 has one slot per tick; each level above spans
+// TW_SIZE slots of the level below and is cascaded down as time reaches
+// it, so each tick only touches the timers that are actually due.
+#define TW_BITS   6
+#define TW_SIZE   (1 << TW_BITS)
+#define TW_MASK   (TW_SIZE - 1)
+#define TW_LEVELS 4
+
+static struct {
+	uint now;                              // last tick the wheel has run
+	uint armed;                            // tick the idle boot CPU wakes at
+	struct proc *slot[TW_LEVELS][TW_SIZE];
+} twheel;
+
 #define EACH_PTABLE_NODE struct ptable_node *node = ptable.head; node->next != 0; node = node->next
 
 static struct proc* initproc;
@@ -32,9 +50,13 @@ void _allocpipe(struct proc* p);
 void _deallocpipe(struct proc* p);
 
 static void wakeup1(void* chan);
+static int rtthrottled(void);
+static void twdel(struct proc* p);
+static void setrunnable(struct proc* p);
+static uint twnext(uint max);
 int growptable();
 
-int procloopread(struct inode* ip, char* buf, int n){
+int procloopread(struct inode* ip, char* buf, uint off, int n){
 	//cprintf("Reading: minor=%d, from proc = %d\n", ip->minor, proc->pid);
 	struct proc *tp;
 	struct proc *p;
@@ -113,13 +135,24 @@ found:
 	p->state = EMBRYO;
 	p->pid = nextpid++;
 	p->priority = PROC_DEFAULT_PRIORITY;
+	p->policy = SCHED_NORMAL;
+	p->rtpriority = 0;
+	p->rtslice = SCHED_RR_TIMESLICE;
 	release(&ptable.lock);
 
-	// Allocate kernel stack.
+	// Allocate kernel stack and vDSO page.
 	if ((p->kstack = kalloc()) == 0) {
 		p->state = UNUSED;
 		return 0;
 	}
+	if ((p->vdsoproc = (struct vdso_proc*)kalloc()) == 0) {
+		kfree(p->kstack);
+		p->kstack = 0;
+		p->state = UNUSED;
+		return 0;
+	}
+	memset(p->vdsoproc, 0, PGSIZE);
+	p->vdsoproc->pid = p->pid;
 	sp = p->kstack + KSTACKSIZE;
 
 	// Leave room for trap frame.
@@ -145,7 +178,7 @@ void userinit(void){
 
 	p = allocproc();
 	initproc = p;
-	if ((p->pgdir = setupkvm()) == 0)
+	if ((p->pgdir = setupkvm()) == 0 || mapvdso(p->pgdir, p) < 0)
 		panic("userinit: out of memory?");
 	inituvm(p->pgdir, _binary_out_initcode_start, (uintp)_binary_out_initcode_size);
 	p->sz = PGSIZE;
@@ -162,7 +195,37 @@ void userinit(void){
 	p->priority = PROC_MAX_PRIORITY;
 	_allocpipe(p);
 
-	p->state = RUNNABLE;
+	acquire(&ptable.lock);
+	setrunnable(p);
+	release(&ptable.lock);
+}
+
+// A kernel thread's first scheduling by scheduler()
+// will swtch here.
+static void kthreadstart(void){
+	// Still holding ptable.lock from scheduler.
+	release(&ptable.lock);
+	proc->kfn(proc->karg);
+	panic("kthread returned");
+}
+
+// Start a kernel thread running fn(arg). It has no user memory
+// and never goes to user space, so fn must never return.
+struct proc* kthread(char* name, void (*fn)(void*), void* arg){
+	struct proc* p;
+
+	if ((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+		panic("kthread: out of memory?");
+	p->context->eip = (uintp)kthreadstart;
+	p->kfn = fn;
+	p->karg = arg;
+	p->blessed = PROC_BLESSED;
+	safestrcpy(p->name, name, sizeof(p->name));
+
+	acquire(&ptable.lock);
+	setrunnable(p);
+	release(&ptable.lock);
+	return p;
 }
 
 // Grow current process's memory by n bytes.
@@ -195,9 +258,14 @@ int _fork(int blessed){
 		return -1;
 
 	// Copy process state from p.
-	if ((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0) {
+	if ((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0 || mapvdso(np->pgdir, np) < 0) {
+		if (np->pgdir)
+			freevm(np->pgdir);
+		np->pgdir = 0;
 		kfree(np->kstack);
 		np->kstack = 0;
+		kfree((char*)np->vdsoproc);
+		np->vdsoproc = 0;
 		np->state = UNUSED;
 		return -1;
 	}
@@ -219,8 +287,10 @@ int _fork(int blessed){
 
 	// lock to force the compiler to emit the np->state write last.
 	acquire(&ptable.lock);
-	np->state = RUNNABLE;
+	np->policy = proc->policy;
+	np->rtpriority = proc->rtpriority;
 	np->blessed = blessed;
+	setrunnable(np);
 	_allocpipe(np);
 	release(&ptable.lock);
 
@@ -304,6 +374,8 @@ int wait(void){
 				kfree(p->kstack);
 				p->kstack = 0;
 				freevm(p->pgdir);
+				kfree((char*)p->vdsoproc);
+				p->vdsoproc = 0;
 				p->state = UNUSED;
 				p->pid = 0;
 				p->parent = 0;
@@ -349,6 +421,7 @@ void scheduler(void){
 		// Loop over process table looking for process to run.
 		uint8 highestpriority = 0;
 		struct proc* bestp = 0;
+		struct proc* bestrt = 0;
 		acquire(&ptable.lock);
 		for(EACH_PTABLE_NODE){
 			p = &(node->proc);
@@ -359,6 +432,15 @@ void scheduler(void){
 				continue;
 			}
 
+			if (p->policy != SCHED_NORMAL) {
+				// RT tasks are picked by rtpriority alone, oldest queued first.
+				if (bestrt == 0 || p->rtpriority > bestrt->rtpriority ||
+				    (p->rtpriority == bestrt->rtpriority && (int)(p->rtqueued - bestrt->rtqueued) < 0)) {
+					bestrt = p;
+				}
+				continue;
+			}
+
 			uint64 effectivepriority = p-> priority > PROC_NO_BOOST_PRIORITY
 									  ? p->priority + p->skipped
 									  : p-> priority;
@@ -380,7 +462,23 @@ void scheduler(void){
 				p->skipped++;
 			}
 		}
+		if(bestrt && (bestp == 0 || !rtthrottled())) {
+			// RT tasks preempt normal ones unless this CPU's RT budget for
+			// the current window is spent and there is normal work to do.
+			if(bestp) {
+				bestp->skipped++;
+			}
+			bestp = bestrt;
+		}
 		if(bestp) {
+			// Only the boot CPU, which keeps time, needs a periodic
+			// tick while running the last runnable task.
+			ptable.nrunnable--;
+			if (cpu->id != 0 && ptable.nrunnable == 0)
+				lapicsettimer(TICK_ONESHOT, NOHZ_MAX_TICKS);
+			else
+				lapicsettimer(TICK_PERIODIC, 0);
+
 			// Switch to chosen process.  It is the process's job
 			// to release ptable.lock and then reacquire it
 			// before jumping back to us.
@@ -396,9 +494,109 @@ void scheduler(void){
 			proc = 0;
 		}
 		release(&ptable.lock);
+
+		if(!bestp) {
+			cpuidle();
+		}
 	}
 }
 
+// Halt this CPU with its tick stopped until an interrupt arrives.
+// The boot CPU keeps time, so it only sleeps until the next timer
+// on the wheel may be due. Returns at once if there is work to run.
+void cpuidle(void){
+	int intena = readeflags() & FL_IF;
+	uint n;
+
+	cli();
+	cpu->idle = 1;
+	amd64_mem_barrier(); // pairs with kickcpu()
+	if (ptable.nrunnable == 0) {
+		if (cpu->id == 0) {
+			acquire(&ptable.lock);
+			n = twnext(NOHZ_MAX_TICKS);
+			twheel.armed = ticks + n;
+			release(&ptable.lock);
+			lapicsettimer(TICK_ONESHOT, n);
+		} else {
+			lapicsettimer(TICK_STOPPED, 0);
+		}
+		amd64_sti_hlt();
+		cli();
+		lapicsettimer(TICK_PERIODIC, 0);
+	}
+	cpu->idle = 0;
+	if (intena)
+		amd64_sti();
+}
+
+// Interrupt a CPU that could run p: an idle one if possible, otherwise
+// one running tickless, which would not notice p until its next tick.
+// The ptable lock must be held.
+static void kickcpu(struct proc* p){
+	struct cpu* c;
+	struct cpu* tickless = 0;
+
+	amd64_mem_barrier(); // pairs with cpuidle()
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c == cpu || !c->started || (c->capabilities & CPU_DISABLED))
+			continue;
+		if ((c->capabilities & CPU_RESERVED_BLESS) && p->blessed != PROC_BLESSED)
+			continue;
+		if (c->idle) {
+			c->idle = 0;
+			lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+			return;
+		}
+		if (tickless == 0 && c->tickmode != TICK_PERIODIC)
+			tickless = c;
+	}
+	if (tickless)
+		lapicipi(tickless->apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// Make p runnable and let an idle or tickless CPU know about it.
+// The ptable lock must be held.
+static void setrunnable(struct proc* p){
+	p->state = RUNNABLE;
+	p->rtqueued = ticks;
+	ptable.nrunnable++;
+	kickcpu(p);
+}
+
+// Returns non-zero if RT tasks have used up this CPU's share of the
+// current throttling window. Starts a new window once it has elapsed.
+static int rtthrottled(void){
+	if (ticks - cpu->rtperiod >= SCHED_RT_PERIOD) {
+		cpu->rtperiod = ticks;
+		cpu->rtused = 0;
+	}
+	return cpu->rtused >= SCHED_RT_RUNTIME;
+}
+
+// Account a timer tick to the process running on this CPU and decide
+// whether to preempt it. Called from trap() on every timer interrupt.
+// Returns non-zero if the process should yield.
+int schedtick(void){
+	if (proc->policy != SCHED_NORMAL) {
+		rtthrottled();
+		cpu->rtused++;
+		if (proc->policy == SCHED_RR && --proc->rtslice == 0) {
+			// Timeslice expired: go to the back of the line for our priority.
+			proc->rtslice = SCHED_RR_TIMESLICE;
+			proc->rtqueued = ticks;
+		}
+	}
+
+	if (ptable.nrunnable > 0)
+		return 1;
+
+	// Nothing else wants a CPU, so skip the scheduler pass.
+	if (cpu->tickmode == TICK_ONESHOT)
+		lapicsettimer(TICK_ONESHOT, NOHZ_MAX_TICKS);
+	return 0;
+}
+
 // Enter scheduler.  Must hold only ptable.lock
 // and have changed proc->state.
 void sched(void){
@@ -421,6 +619,7 @@ void sched(void){
 void yield(void){
 	acquire(&ptable.lock);
 	proc->state = RUNNABLE;
+	ptable.nrunnable++;
 	sched();
 	release(&ptable.lock);
 }
@@ -487,7 +686,9 @@ static void wakeup1(void* chan){
 	for(EACH_PTABLE_NODE){
 		p = &(node->proc);
 		if (p->state == SLEEPING && p->chan == chan) {
-			p->state = RUNNABLE;
+			if (p->tpprev)
+				twdel(p); // a sleeptimeout() woken early
+			setrunnable(p);
 		}
 	}
 }
@@ -500,6 +701,152 @@ wakeup(void* chan){
 	release(&ptable.lock);
 }
 
+// Put p on the timer wheel slot for p->wakeat.
+// The ptable lock must be held.
+static void twadd(struct proc* p){
+	uint expires = p->wakeat;
+	uint delta = expires - twheel.now;
+	struct proc** slot;
+	int level;
+
+	for (level = 0; level < TW_LEVELS - 1; level++)
+		if (delta < (1u << (TW_BITS * (level + 1))))
+			break;
+	if (level == TW_LEVELS - 1 && delta >= (1u << (TW_BITS * TW_LEVELS))) {
+		// Beyond the top level: park in its furthest slot, the real
+		// deadline is honoured when the entry cascades back down.
+		expires = twheel.now + (1u << (TW_BITS * TW_LEVELS)) - 1;
+	}
+
+	slot = &twheel.slot[level][(expires >> (TW_BITS * level)) & TW_MASK];
+	p->tnext = *slot;
+	if (p->tnext)
+		p->tnext->tpprev = &p->tnext;
+	p->tpprev = slot;
+	*slot = p;
+
+	// The idle boot CPU sleeps until twheel.armed; wake it up early
+	// so it can re-arm for this deadline.
+	if (cpus[0].idle && cpu != &cpus[0] && (int)(p->wakeat - twheel.armed) < 0) {
+		cpus[0].idle = 0;
+		lapicipi(cpus[0].apicid, T_IRQ0 + IRQ_RESCHED);
+	}
+}
+
+// Ticks until the next timer on the wheel may be due, at most max.
+// Stops at the next cascade point, where higher levels come due.
+// The ptable lock must be held.
+static uint twnext(uint max){
+	uint n, t;
+
+	for (n = 1; n < max; n++) {
+		t = twheel.now + n;
+		if ((t & TW_MASK) == 0 || twheel.slot[0][t & TW_MASK])
+			break;
+	}
+	return n;
+}
+
+// Take p off the timer wheel.
+// The ptable lock must be held.
+static void twdel(struct proc* p){
+	*p->tpprev = p->tnext;
+	if (p->tnext)
+		p->tnext->tpprev = p->tpprev;
+	p->tnext = 0;
+	p->tpprev = 0;
+}
+
+// Re-file every entry of a higher-level slot relative to twheel.now.
+static void twcascade(int level, int idx){
+	struct proc* p = twheel.slot[level][idx];
+	struct proc* next;
+
+	twheel.slot[level][idx] = 0;
+	for (; p; p = next) {
+		next = p->tnext;
+		p->tpprev = 0;
+		twadd(p);
+	}
+}
+
+// Run the timer wheel up to the current tick, waking every process
+// whose timed sleep has expired. Called from the timer interrupt.
+void twadvance(void){
+	struct proc* p;
+	int level, idx;
+
+	acquire(&ptable.lock);
+	while ((int)(ticks - twheel.now) > 0) {
+		twheel.now++;
+		idx = twheel.now & TW_MASK;
+		if (idx == 0) {
+			for (level = 1; level < TW_LEVELS; level++) {
+				int i = (twheel.now >> (TW_BITS * level)) & TW_MASK;
+				twcascade(level, i);
+				if (i != 0)
+					break;
+			}
+		}
+		while ((p = twheel.slot[0][idx]) != 0) {
+			twdel(p);
+			setrunnable(p);
+		}
+	}
+	release(&ptable.lock);
+}
+
+// Sleep for n ticks. Returns -1 if the process was killed.
+int sleepticks(uint n){
+	int killed;
+
+	if (proc == 0)
+		panic("sleepticks");
+
+	acquire(&ptable.lock);
+	if (n > 0 && !proc->killed) {
+		proc->wakeat = ticks + n;
+		twadd(proc);
+		proc->chan = &twheel;
+		proc->state = SLEEPING;
+		sched();
+		proc->chan = 0;
+	}
+	killed = proc->killed;
+	release(&ptable.lock);
+	return killed ? -1 : 0;
+}
+
+// Like sleep(), but give up after n ticks.
+// Returns 0 if woken on chan, -1 if the time ran out.
+int sleeptimeout(void* chan, struct spinlock* lk, uint n){
+	int timedout;
+
+	if (proc == 0)
+		panic("sleeptimeout");
+
+	if (lk != &ptable.lock) {
+		acquire(&ptable.lock);
+		release(lk);
+	}
+
+	proc->wakeat = ticks + n;
+	twadd(proc);
+	proc->chan = chan;
+	proc->state = SLEEPING;
+	sched();
+	proc->chan = 0;
+	// twadvance() takes an expired sleeper off the wheel, wakeup1() an
+	// early one; kill() does so too, but that counts as a wakeup.
+	timedout = (int)(ticks - proc->wakeat) >= 0;
+
+	if (lk != &ptable.lock) {
+		release(&ptable.lock);
+		acquire(lk);
+	}
+	return timedout ? -1 : 0;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -512,8 +859,11 @@ int kill(int pid){
 		if (p->pid == pid) {
 			p->killed = 1;
 			// Wake process from sleep if necessary.
-			if (p->state == SLEEPING)
-				p->state = RUNNABLE;
+			if (p->state == SLEEPING) {
+				if (p->tpprev)
+					twdel(p);
+				setrunnable(p);
+			}
 			release(&ptable.lock);
 			return 0;
 		}
@@ -630,6 +980,49 @@ int setpriority(int pid, int priority) {
 	return -1;
 }
 
+int getscheduler(int pid) {
+	struct proc* p;
+
+	for(EACH_PTABLE_NODE){
+		p = &(node->proc);
+		if (p->pid == pid) {
+			return p->policy;
+		}
+	}
+	return -1;
+}
+
+int setscheduler(int pid, int policy, int rtpriority) {
+	struct proc* p;
+
+	if(proc->blessed != PROC_BLESSED) {
+		// only blessed procs can change scheduling classes
+		return -1;
+	}
+
+	if (policy == SCHED_NORMAL) {
+		rtpriority = 0;
+	} else if ((policy != SCHED_FIFO && policy != SCHED_RR) ||
+	           rtpriority < 1 || rtpriority > SCHED_RT_MAX_PRIORITY) {
+		return -1;
+	}
+
+	acquire(&ptable.lock);
+	for(EACH_PTABLE_NODE){
+		p = &(node->proc);
+		if (p->pid == pid) {
+			p->policy = policy;
+			p->rtpriority = rtpriority;
+			p->rtslice = SCHED_RR_TIMESLICE;
+			p->rtqueued = ticks;
+			release(&ptable.lock);
+			return 1;
+		}
+	}
+	release(&ptable.lock);
+	return -1;
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
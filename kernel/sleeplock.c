@@ -0,0 +1,127 @@
+// Sleeping locks: a mutex and a reader-writer semaphore
+// for things held across disk I/O, such as inodes and buffers.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "sleeplock.h"
+
+void initsleeplock(struct sleeplock* lk, char* name){
+	initlock(&lk->lk, "sleep lock");
+	lk->name = name;
+	lk->locked = 0;
+	lk->owner = 0;
+	lk->pid = 0;
+}
+
+void acquiresleep(struct sleeplock* lk){
+	acquire(&lk->lk);
+	while (lk->locked)
+		sleep(lk, &lk->lk);
+	lk->locked = 1;
+	lk->owner = proc;
+	lk->pid = proc ? proc->pid : 0;
+	release(&lk->lk);
+}
+
+void releasesleep(struct sleeplock* lk){
+	acquire(&lk->lk);
+	lk->locked = 0;
+	lk->owner = 0;
+	lk->pid = 0;
+	wakeup(lk);
+	release(&lk->lk);
+}
+
+// Check whether this process is holding the lock.
+int holdingsleep(struct sleeplock* lk){
+	int r;
+
+	acquire(&lk->lk);
+	r = lk->locked && lk->owner == proc;
+	release(&lk->lk);
+	return r;
+}
+
+void initrwsem(struct rwsem* rw, char* name){
+	initlock(&rw->lk, "rwsem");
+	rw->name = name;
+	rw->readers = 0;
+	rw->writing = 0;
+	rw->wwait = 0;
+	rw->owner = 0;
+}
+
+// Acquire rw shared.
+void downread(struct rwsem* rw){
+	acquire(&rw->lk);
+	while (rw->writing || rw->wwait > 0)
+		sleep(&rw->readers, &rw->lk);
+	rw->readers++;
+	release(&rw->lk);
+}
+
+void upread(struct rwsem* rw){
+	acquire(&rw->lk);
+	if (rw->readers < 1)
+		panic("upread");
+	if (--rw->readers == 0)
+		wakeup(&rw->wwait);
+	release(&rw->lk);
+}
+
+// Acquire rw exclusively.
+void downwrite(struct rwsem* rw){
+	acquire(&rw->lk);
+	rw->wwait++;
+	while (rw->writing || rw->readers > 0)
+		sleep(&rw->wwait, &rw->lk);
+	rw->wwait--;
+	rw->writing = 1;
+	rw->owner = proc;
+	release(&rw->lk);
+}
+
+void upwrite(struct rwsem* rw){
+	acquire(&rw->lk);
+	if (!rw->writing)
+		panic("upwrite");
+	rw->writing = 0;
+	rw->owner = 0;
+	// Writers first; readers that wake up still see wwait and wait.
+	wakeup(&rw->wwait);
+	wakeup(&rw->readers);
+	release(&rw->lk);
+}
+
+// Release rw in whichever mode this process holds it.
+void uprw(struct rwsem* rw){
+	if (holdingwrite(rw))
+		upwrite(rw);
+	else
+		upread(rw);
+}
+
+// Check whether this process holds rw exclusively.
+int holdingwrite(struct rwsem* rw){
+	int r;
+
+	acquire(&rw->lk);
+	r = rw->writing && rw->owner == proc;
+	release(&rw->lk);
+	return r;
+}
+
+// Check whether anyone holds rw, in either mode.
+int rwsemlocked(struct rwsem* rw){
+	int r;
+
+	acquire(&rw->lk);
+	r = rw->writing || rw->readers > 0;
+	release(&rw->lk);
+	return r;
+}
@@ -8,12 +8,149 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "file.h"
+#include "lockstat.h"
+#include "kernel/string.h"
 
+#if LOCK_STATS
+// Every initialized lock, for the lockstat device, linked through
+// statnext/statprev. statlist is guarded by a bare flag rather than
+// a spinlock: kinit1() initializes a lock before cpu is set up, so
+// pushcli() doesn't work yet.
+static struct spinlock* statlist;
+static volatile uint statbusy;
+
+static int statlock(void){
+	int eflags;
+
+	eflags = readeflags();
+	cli();
+	while (amd64_xchg(&statbusy, 1) != 0)
+		amd64_pause();
+	return eflags;
+}
+
+static void statunlock(int eflags){
+	amd64_xchg(&statbusy, 0);
+	if (eflags & FL_IF)
+		amd64_sti();
+}
+
+// Link lk into statlist after prev, or first if prev is 0.
+// Caller holds statbusy.
+static void statinsert(struct spinlock* lk, struct spinlock* prev){
+	lk->statprev = prev;
+	lk->statnext = prev ? prev->statnext : statlist;
+	if (lk->statnext)
+		lk->statnext->statprev = lk;
+	if (prev)
+		prev->statnext = lk;
+	else
+		statlist = lk;
+}
+
+// Unlink lk from statlist. Caller holds statbusy.
+static void statremove(struct spinlock* lk){
+	if (lk->statprev)
+		lk->statprev->statnext = lk->statnext;
+	else
+		statlist = lk->statnext;
+	if (lk->statnext)
+		lk->statnext->statprev = lk->statprev;
+}
+#endif
+
+// Each lock must be initialized once, and destroyed before its
+// memory is freed.
 void initlock(struct spinlock* lk, char* name){
 	lk->name = name;
-	lk->locked = 0;
+	lk->ticket = 0;
 	lk->cpu = 0;
 	lk->sig = SPINLOCK_SIG;
+	lk->acquired = lk->contended = 0;
+	lk->spincycles = lk->maxspin = lk->holdcycles = 0;
+#if LOCK_STATS
+	int eflags = statlock();
+	statinsert(lk, 0);
+	statunlock(eflags);
+#endif
+}
+
+// Forget a lock whose memory is about to be freed.
+void destroylock(struct spinlock* lk){
+#if LOCK_STATS
+	int eflags = statlock();
+	statremove(lk);
+	statunlock(eflags);
+#endif
+}
+
+// Read the statistics of every registered lock, one struct
+// lockstat each, from byte off on. The numbers are not read under
+// the locks, so may be slightly stale.
+//
+// statlist holds every buffer, inode and sleeplock spinlock, so it
+// is walked LOCKSTAT_BATCH locks at a time: a cursor, a dummy
+// lock without SPINLOCK_SIG, keeps our place in the list while
+// statbusy is dropped to copy the batch out.
+static int lockstatread(struct inode* ip, char* dst, uint off, int n){
+#if LOCK_STATS
+	struct lockstat batch[LOCKSTAT_BATCH];
+	struct spinlock cursor, * lk, * prev;
+	uint skip, i, m, tot;
+	int nb, steps, eflags;
+
+	cursor.sig = 0;
+	skip = off / sizeof(batch[0]);
+	tot = 0;
+	eflags = statlock();
+	statinsert(&cursor, 0);
+	do {
+		nb = 0;
+		prev = &cursor;
+		for (steps = 0; steps < LOCKSTAT_BATCH && (lk = prev->statnext); steps++) {
+			prev = lk;
+			if (lk->sig != SPINLOCK_SIG) // another reader's cursor
+				continue;
+			if (skip > 0) {
+				skip--;
+				continue;
+			}
+			memset(&batch[nb], 0, sizeof(batch[nb]));
+			safestrcpy(batch[nb].name, lk->name, sizeof(batch[nb].name));
+			batch[nb].acquired = lk->acquired;
+			batch[nb].contended = lk->contended;
+			batch[nb].spincycles = lk->spincycles;
+			batch[nb].maxspin = lk->maxspin;
+			batch[nb].holdcycles = lk->holdcycles;
+			memmove(batch[nb].pcs, lk->cpcs, sizeof(batch[nb].pcs));
+			nb++;
+		}
+		if (prev != &cursor) {
+			statremove(&cursor);
+			statinsert(&cursor, prev);
+		}
+		statunlock(eflags);
+
+		for (i = 0; i < nb && tot < n; i++, tot += m, off += m) {
+			m = n - tot;
+			if (m > sizeof(batch[i]) - off % sizeof(batch[i]))
+				m = sizeof(batch[i]) - off % sizeof(batch[i]);
+			memmove(dst + tot, (char*)&batch[i] + off % sizeof(batch[i]), m);
+		}
+
+		eflags = statlock();
+	} while (cursor.statnext && tot < n);
+	statremove(&cursor);
+	statunlock(eflags);
+	return tot;
+#else
+	return 0;
+#endif
+}
+
+void lockstatinit(void){
+	devsw[LOCKSTAT].read = lockstatread;
 }
 
 
@@ -28,7 +165,13 @@ void acquire(struct spinlock* lk){
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
+// With a finite wait (in ticks) give up and return
+// SPINLOCK_NOT_ACQUIRED once it has passed.
 uint8 sacquire(struct spinlock* lk, uint32 wait){
+	uint16 me;
+	uint t;
+	uint64 spin = 0;
+
 	pushcli(); // disable interrupts to avoid deadlock.
 	if (holding(lk)) {
 		int i;
@@ -38,20 +181,53 @@ uint8 sacquire(struct spinlock* lk, uint32 wait){
 		cprintf("\n");
 		panic("acquire: already holding lock");
 	}
-	// The amd64_xchg is atomic.
-	// It also serializes, so that reads after acquire are not
-	// reordered before it.
-	uint32 startticks = ticks;
-	while (amd64_xchg(&lk->locked, 1) != 0) {
-		uint32 delta = ticks - startticks;
-		if(delta > wait){
-			return SPINLOCK_NOT_ACQUIRED;
+	// The locked xadd/cmpxchg are atomic and serialize, so that
+	// reads after acquire are not reordered before them.
+	if (wait == UINT32_MAX) {
+		// Take a ticket and wait our turn. Waiters only read the
+		// lock while spinning, and PAUSE keeps the spin cheap.
+		me = amd64_xadd(&lk->ticket, SPINLOCK_TICKET) >> 16;
+		if (lk->owner != me) {
+			spin = amd64_rdtsc();
+			while (lk->owner != me)
+				amd64_pause();
+			spin = amd64_rdtsc() - spin;
+		}
+	} else {
+		// A ticket can't be handed back, so only take one when
+		// the lock is free and it will be served at once.
+		uint32 startticks = ticks;
+		for (;;) {
+			t = lk->ticket;
+			if ((t & 0xFFFF) == (t >> 16) &&
+			    amd64_cmpxchg(&lk->ticket, t, t + SPINLOCK_TICKET) == t)
+				break;
+			if (ticks - startticks > wait) {
+				popcli();
+				return SPINLOCK_NOT_ACQUIRED;
+			}
+			if (spin == 0)
+				spin = amd64_rdtsc();
+			amd64_pause();
 		}
+		if (spin)
+			spin = amd64_rdtsc() - spin;
 	}
 
 	// Record info about lock acquisition for debugging.
 	lk->cpu = cpu;
 	getcallerpcs(&lk, lk->pcs);
+#if LOCK_STATS
+	lk->acquired++;
+	if (spin) {
+		lk->contended++;
+		lk->spincycles += spin;
+		if (spin > lk->maxspin)
+			lk->maxspin = spin;
+		memmove(lk->cpcs, lk->pcs, sizeof(lk->cpcs));
+	}
+	lk->acqtsc = amd64_rdtsc();
+#endif
 	return SPINLOCK_ACQUIRED;
 }
 
@@ -62,17 +238,15 @@ void release(struct spinlock* lk){
 
 	lk->pcs[0] = 0;
 	lk->cpu = 0;
+#if LOCK_STATS
+	lk->holdcycles += amd64_rdtsc() - lk->acqtsc;
+#endif
 
-	// The amd64_xchg serializes, so that reads before release are
-	// not reordered after it.  The 1996 PentiumPro manual (Volume 3,
-	// 7.2) says reads can be carried out speculatively and in
-	// any order, which implies we need to serialize here.
-	// But the 2007 Intel 64 Architecture Memory Ordering White
-	// Paper says that Intel 64 and IA-32 will not move a load
-	// after a store. So lock->locked = 0 would work here.
-	// The amd64_xchg being asm volatile ensures gcc emits it after
-	// the above assignments (and after the critical section).
-	amd64_xchg(&lk->locked, 0);
+	// Only the holder writes owner, so a plain store hands the lock
+	// to the next ticket. x86 does not move earlier loads or stores
+	// after a store, and the barrier keeps gcc from doing so.
+	asm volatile ("" : : : "memory");
+	lk->owner++;
 
 	popcli();
 }
@@ -103,7 +277,7 @@ int holding(struct spinlock* lock){
 	if(lock->sig != SPINLOCK_SIG) {
 		panic("*lock is not a lock\n");
 	}
-	return lock->locked && lock->cpu == cpu;
+	return lock->owner != lock->next && lock->cpu == cpu;
 }
 
 // Pushcli/popcli are like cli/sti except that they are matched:
@@ -6,12 +6,15 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "scstat.h"
+#include "percpu.h"
+#include "file.h"
+#include "kernel/string.h"
 
-// User code makes a system call with INT T_SYSCALL.
+// User code makes a system call with SYSCALL (or INT T_SYSCALL).
 // System call number in %eax.
-// Arguments on the stack, from the user call to the C
-// library system call function. The saved user %esp points
-// to a saved program counter, and then the first argument.
+// Arguments in %rdi, %rsi, %rdx, %rcx (%r10 for SYSCALL), %r8
+// and %r9, following the x86-64 calling convention.
 
 // Fetch the int at addr from the current process.
 int fetchint(uintp addr, int* ip){
@@ -137,6 +140,13 @@ extern int sys_nprocs(void);
 extern int sys_cpuhalt(void);
 extern int sys_getpriority(void);
 extern int sys_setpriority(void);
+extern int sys_getscheduler(void);
+extern int sys_setscheduler(void);
+extern int sys_clock_gettime(void);
+extern int sys_nanosleep(void);
+extern int sys_ioring_enter(void);
+extern int sys_sync(void);
+extern int sys_fsync(void);
 
 static int (*syscalls[])(void) = {
 	[SYS_fork]          sys_fork,
@@ -178,15 +188,80 @@ static int (*syscalls[])(void) = {
 	[SYS_cpuhalt]       sys_cpuhalt,
 	[SYS_getpriority]   sys_getpriority,
 	[SYS_setpriority]   sys_setpriority,
+	[SYS_getscheduler]  sys_getscheduler,
+	[SYS_setscheduler]  sys_setscheduler,
+	[SYS_clock_gettime] sys_clock_gettime,
+	[SYS_nanosleep]     sys_nanosleep,
+	[SYS_ioring_enter]  sys_ioring_enter,
+	[SYS_sync]          sys_sync,
+	[SYS_fsync]         sys_fsync,
 };
 
+// Called by syscallentry and by trap() for INT T_SYSCALL.
+void syscalltrap(struct trapframe* tf){
+	if (proc->killed)
+		exit();
+	proc->tf = tf;
+	syscall();
+	if (proc->killed)
+		exit();
+}
+
+// System call statistics in per-CPU counters, so that CPUs making
+// calls never share a cache line or a lock; readers add up the
+// copies and may see a count a call or two ahead of its histogram.
+static DEFINE_PCOUNTER(sccalls[SCSTAT_NSYS]);
+static DEFINE_PCOUNTER(sccycles[SCSTAT_NSYS]);
+static DEFINE_PCOUNTER(schist[SCSTAT_NSYS][SCSTAT_BUCKETS]);
+
+static void scaccount(int num, uint64 start){
+	uint64 cycles;
+	int b;
+
+	cycles = amd64_rdtsc() - start;
+	for (b = 0; b < SCSTAT_BUCKETS - 1 && (cycles >> (b + 1)) != 0; b++)
+		;
+	pcounteradd(&sccalls[num], 1);
+	pcounteradd(&sccycles[num], cycles);
+	pcounteradd(&schist[num][b], 1);
+}
+
+// Read the totals for all CPUs as an array of struct scstat,
+// from byte off on; past the end of the array is end of file.
+static int scstatread(struct inode* ip, char* dst, uint off, int n){
+	struct scstat st;
+	uint num, i, m, tot;
+
+	for (tot = 0; tot < n && off < SCSTAT_NSYS * sizeof(st); tot += m, off += m) {
+		num = off / sizeof(st);
+		st.count = pcountersum(&sccalls[num]);
+		st.cycles = pcountersum(&sccycles[num]);
+		for (i = 0; i < SCSTAT_BUCKETS; i++)
+			st.hist[i] = pcountersum(&schist[num][i]);
+		i = off % sizeof(st);
+		m = n - tot;
+		if (m > sizeof(st) - i)
+			m = sizeof(st) - i;
+		memmove(dst + tot, (char*)&st + i, m);
+	}
+	return tot;
+}
+
+void scstatinit(void){
+	devsw[SCSTAT].read = scstatread;
+}
+
 void syscall(void){
 	int num;
+	uint64 start;
 
 	num = proc->tf->eax;
 	if (num > 0 && num < NELEM(syscalls) && syscalls[num]) {
 		proc->lastsyscall = num;
+		start = amd64_rdtsc();
 		proc->tf->eax = syscalls[num]();
+		if (num < SCSTAT_NSYS)
+			scaccount(num, start);
 	} else {
 		cprintf("%d %s: unknown sys call %d\n",
 		        proc->pid, proc->name, num);
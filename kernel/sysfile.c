@@ -13,6 +13,7 @@
 #include "fs/fs1.h"
 #include "file.h"
 #include "fcntl.h"
+#include "ioring.h"
 #include "kernel/string.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
@@ -88,15 +89,20 @@ int sys_write(void){
 	return filewrite(f, p, n);
 }
 
+// Release descriptor fd of the current process.
+static int fdclose(int fd, struct file* f){
+	proc->ofile[fd] = 0;
+	fileclose(f);
+	return 0;
+}
+
 int sys_close(void){
 	int fd;
 	struct file* f;
 
 	if (argfd(0, &fd, &f) < 0)
 		return -1;
-	proc->ofile[fd] = 0;
-	fileclose(f);
-	return 0;
+	return fdclose(fd, f);
 }
 
 int sys_fstat(void){
@@ -108,6 +114,36 @@ int sys_fstat(void){
 	return filestat(f, st);
 }
 
+// Write everything committed so far to its home location.
+int sys_sync(void){
+	logsync();
+	return 0;
+}
+
+// Wait until the changes made to fd's inode are committed to the log,
+// and data written around the log, through any fd, is out of the
+// drive's cache.
+int sys_fsync(void){
+	struct file* f;
+	struct inode* ip;
+	uint dwrites;
+
+	if (argfd(0, 0, &f) < 0)
+		return -1;
+	if (f->type != FD_INODE)
+		return -1;
+	ip = f->ip;
+	dwrites = ip->dwrites;
+	logforce(ip->lsn);
+	if (dwrites != ip->dflushed) {
+		blkflush(ip->dev);
+		// Racing fsyncs may store an older count; that only
+		// costs a later fsync another flush.
+		ip->dflushed = dwrites;
+	}
+	return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int sys_link(void){
 	char name[DIRSIZ], * new, * old;
@@ -269,15 +305,12 @@ static struct inode* create(char* path, short type, short major, short minor){
 	return ip;
 }
 
-int sys_open(void){
-	char* path;
-	int fd, omode;
+// Open path with mode omode and return a new descriptor for it.
+static int openpath(char* path, int omode){
+	int fd;
 	struct file* f;
 	struct inode* ip;
 
-	if (argstr(0, &path) < 0 || argint(1, &omode) < 0)
-		return -1;
-
 	begin_op();
 
 	if (omode & O_CREATE) {
@@ -292,7 +325,7 @@ int sys_open(void){
 			return -1;
 		}
 		ilock(ip);
-		if (ip->type == T_DIR && omode != O_RDONLY) {
+		if (ip->type == T_DIR && (omode & ~O_DIRECT) != O_RDONLY) {
 			iunlockput(ip);
 			end_op();
 			return -1;
@@ -314,9 +347,19 @@ int sys_open(void){
 	f->off = 0;
 	f->readable = !(omode & O_WRONLY);
 	f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+	f->direct = (omode & O_DIRECT) != 0;
 	return fd;
 }
 
+int sys_open(void){
+	char* path;
+	int omode;
+
+	if (argstr(0, &path) < 0 || argint(1, &omode) < 0)
+		return -1;
+	return openpath(path, omode);
+}
+
 int sys_mkdir(void){
 	char* path;
 	struct inode* ip;
@@ -437,3 +480,86 @@ int sys_pipe(void){
 	fd[1] = fd1;
 	return 0;
 }
+
+// Look up descriptor fd of the current process.
+static struct file* fdfile(int fd){
+	if (fd < 0 || fd >= NOFILE)
+		return 0;
+	return proc->ofile[fd];
+}
+
+// Run one submission queue entry and return its result.
+static int ioring_exec(struct io_sqe* sqe){
+	struct file* f;
+	char* path;
+
+	switch (sqe->op) {
+	case IORING_OP_NOP:
+		return 0;
+	case IORING_OP_READ:
+	case IORING_OP_WRITE:
+		if ((f = fdfile(sqe->fd)) == 0 || sqe->len < 0)
+			return -1;
+		if (sqe->addr >= proc->sz || sqe->addr + sqe->len > proc->sz)
+			return -1;
+		if (sqe->op == IORING_OP_READ)
+			return fileread(f, (char*)sqe->addr, sqe->len);
+		return filewrite(f, (char*)sqe->addr, sqe->len);
+	case IORING_OP_OPEN:
+		if (fetchstr(sqe->addr, &path) < 0)
+			return -1;
+		return openpath(path, sqe->len);
+	case IORING_OP_CLOSE:
+		if ((f = fdfile(sqe->fd)) == 0)
+			return -1;
+		return fdclose(sqe->fd, f);
+	case IORING_OP_SEEK:
+		if ((f = fdfile(sqe->fd)) == 0)
+			return -1;
+		return fileseek(f, sqe->len);
+	}
+	return -1;
+}
+
+// Run up to n queued submissions from the ring and post a completion
+// for each. Stops early if the completion queue fills up, so user
+// space must reap completions before submitting more than it can hold.
+// Returns the number of entries consumed.
+int sys_ioring_enter(void){
+	struct ioring* r;
+	struct io_sqe sqe;
+	struct io_cqe* cqe;
+	uint head, tail, cqtail;
+	int n, done, res, skip;
+
+	if (argptr(0, (void*)&r, sizeof(*r)) < 0 || argint(1, &n) < 0)
+		return -1;
+
+	head = r->sqhead;
+	tail = r->sqtail;
+	cqtail = r->cqtail;
+	if (tail - head > IORING_ENTRIES)
+		return -1;
+
+	skip = 0;
+	for (done = 0; done < n && head != tail && !proc->killed; done++) {
+		if (cqtail - r->cqhead >= IORING_ENTRIES)
+			break;
+		// Copy the entry: user space may scribble on the ring meanwhile.
+		sqe = r->sq[head & (IORING_ENTRIES - 1)];
+		head++;
+		if (skip)
+			res = -1;
+		else
+			res = ioring_exec(&sqe);
+		skip = res < 0 && (sqe.flags & IORING_F_LINK);
+
+		cqe = &r->cq[cqtail & (IORING_ENTRIES - 1)];
+		cqe->udata = sqe.udata;
+		cqe->res = res;
+		cqtail++;
+		r->sqhead = head;
+		r->cqtail = cqtail;
+	}
+	return done;
+}
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "time.h"
 
 int sys_fork(void){
 	return fork();
@@ -45,21 +46,12 @@ uintp sys_sbrk(void){
 
 int sys_sleep(void){
 	int n;
-	uint ticks0;
 
 	if (argint(0, &n) < 0)
 		return -1;
-	acquire(&tickslock);
-	ticks0 = ticks;
-	while (ticks - ticks0 < n) {
-		if (proc->killed) {
-			release(&tickslock);
-			return -1;
-		}
-		sleep(&ticks, &tickslock);
-	}
-	release(&tickslock);
-	return 0;
+	if (n < 0)
+		n = 0;
+	return sleepticks(n);
 }
 
 int sys_ticks(void) {
@@ -105,7 +97,8 @@ int sys_amblessed(void){
 
 void sys_cpuhalt(void) {
 	if(proc->blessed) {
-		amd64_hlt();
+		cpuidle();
+		yield();
 	}
 }
 
@@ -148,3 +141,72 @@ int sys_setpriority(void) {
 		return -1;
 	return setpriority(pid, priority);
 }
+
+int sys_getscheduler(void){
+	int pid;
+
+	if (argint(0, &pid) < 0)
+		return -1;
+	return getscheduler(pid);
+}
+
+int sys_setscheduler(void) {
+	int pid;
+	int policy;
+	int rtpriority;
+
+	if (argint(0, &pid) < 0 || argint(1, &policy) < 0 || argint(2, &rtpriority) < 0)
+		return -1;
+	return setscheduler(pid, policy, rtpriority);
+}
+
+int sys_clock_gettime(void) {
+	int clockid;
+	struct timespec* ts;
+	uint64 now;
+
+	if (argint(0, &clockid) < 0 || argptr(1, (char**)&ts, sizeof(*ts)) < 0)
+		return -1;
+	if (clockid != CLOCK_MONOTONIC)
+		return -1;
+	now = nsecs();
+	ts->tv_sec = now / NSEC_PER_SEC;
+	ts->tv_nsec = now % NSEC_PER_SEC;
+	return 0;
+}
+
+// Whole ticks are slept on the timer wheel; the last partial tick is
+// waited out by yielding the CPU until the TSC clock passes the deadline.
+int sys_nanosleep(void) {
+	struct timespec* req;
+	struct timespec* rem;
+	uintp remaddr;
+	uint64 deadline, now;
+
+	if (argptr(0, (char**)&req, sizeof(*req)) < 0 || arguintp(1, &remaddr) < 0)
+		return -1;
+	if (remaddr != 0 && argptr(1, (char**)&rem, sizeof(*rem)) < 0)
+		return -1;
+	if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= NSEC_PER_SEC)
+		return -1;
+
+	deadline = nsecs() + req->tv_sec * NSEC_PER_SEC + req->tv_nsec;
+	while ((now = nsecs()) < deadline) {
+		if (deadline - now > NSEC_PER_TICK) {
+			if (sleepticks((deadline - now) / NSEC_PER_TICK) == 0)
+				continue;
+		} else if (!proc->killed) {
+			yield();
+			continue;
+		}
+		// killed: report how much of the request was left
+		now = nsecs();
+		if (remaddr != 0) {
+			now = now < deadline ? deadline - now : 0;
+			rem->tv_sec = now / NSEC_PER_SEC;
+			rem->tv_nsec = now % NSEC_PER_SEC;
+		}
+		return -1;
+	}
+	return 0;
+}
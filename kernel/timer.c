@@ -1,11 +1,17 @@
 // Intel 8253/8254/82C54 Programmable Interval Timer (PIT).
-// Only used on uniprocessors;
-// SMP machines use the local APIC timer.
+// Channel 0 is only used on uniprocessors; SMP machines use the
+// local APIC timer. Channel 2 provides a known interval that the
+// LAPIC timer and the TSC are calibrated against at boot.
+//
+// Also home of the TSC-based monotonic clock.
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
 #include "irq.h"
 #include "x86.h"
+#include "time.h"
+#include "vdso.h"
 
 #define IO_TIMER1       0x040           // 8253 Timer #1
 
@@ -17,14 +23,75 @@
 #define TIMER_DIV(x)    ((TIMER_FREQ + (x) / 2) / (x))
 
 #define TIMER_MODE      (IO_TIMER1 + 3) // timer mode port
+#define TIMER_CNTR2     (IO_TIMER1 + 2) // timer 2 counter port
 #define TIMER_SEL0      0x00    // select counter 0
+#define TIMER_SEL2      0x80    // select counter 2
+#define TIMER_INTTC     0x00    // mode 0, interrupt on terminal count
 #define TIMER_RATEGEN   0x04    // mode 2, rate generator
 #define TIMER_16BIT     0x30    // r/w counter 16 bits, LSB first
 
+#define IO_PPI          0x061   // keyboard controller port B
+#define PPI_GATE2       0x01    // timer 2 gate
+#define PPI_SPKR        0x02    // speaker data enable
+#define PPI_OUT2        0x20    // timer 2 output
+
 void timerinit(void){
-	// Interrupt 100 times/sec.
+	// Interrupt HZ times/sec.
 	amd64_out8(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-	amd64_out8(IO_TIMER1, TIMER_DIV(100) % 256);
-	amd64_out8(IO_TIMER1, TIMER_DIV(100) / 256);
+	amd64_out8(IO_TIMER1, TIMER_DIV(HZ) % 256);
+	amd64_out8(IO_TIMER1, TIMER_DIV(HZ) / 256);
 	picenable(IRQ_TIMER);
 }
+
+// Start timer 2 counting down ms milliseconds (at most 54).
+// The speaker stays disconnected.
+void pitdelaystart(uint ms){
+	uint count = TIMER_FREQ * ms / 1000;
+
+	amd64_out8(IO_PPI, (amd64_in8(IO_PPI) & ~PPI_SPKR) | PPI_GATE2);
+	amd64_out8(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+	amd64_out8(TIMER_CNTR2, count % 256);
+	amd64_out8(TIMER_CNTR2, count / 256);
+}
+
+// Spin until the countdown started by pitdelaystart() expires.
+void pitdelaywait(void){
+	while ((amd64_in8(IO_PPI) & PPI_OUT2) == 0)
+		amd64_pause();
+}
+
+// The TSC clock converts cycles to nanoseconds with a fixed-point
+// multiplier: ns = (cycles * tscmult) >> 32.
+static uint64 tschz;    // TSC cycles per second, 0 until calibrated
+static uint64 tscmult;
+static uint64 tscboot;  // TSC value when the clock was started
+
+// Start the monotonic clock. Called once by the boot CPU with the
+// TSC frequency measured in lapiccalibrate().
+void tscinit(uint64 hz){
+	if (hz == 0)
+		return;
+	tscmult = ((uint64)NSEC_PER_SEC << 32) / hz;
+	tscboot = amd64_rdtsc();
+	tschz = hz;
+}
+
+// TSC cycles per second, or 0 if the TSC has not been calibrated.
+uint64 tscfreq(void){
+	return tschz;
+}
+
+// Publish the clock parameters so user space can read the TSC clock.
+void tscvdso(struct vdso_data* v){
+	v->tschz = tschz;
+	v->tscmult = tscmult;
+	v->tscboot = tscboot;
+}
+
+// Nanoseconds since the clock was started. All CPUs share one
+// invariant TSC. Falls back to tick resolution until calibrated.
+uint64 nsecs(void){
+	if (tschz == 0)
+		return (uint64)ticks * NSEC_PER_TICK;
+	return ((unsigned __int128)(amd64_rdtsc() - tscboot) * tscmult) >> 32;
+}
@@ -8,6 +8,8 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "irq.h"
+#include "time.h"
+#include "vdso.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -29,21 +31,27 @@ void trapinit() {
 
 void trap(struct trapframe* tf){
 	if (tf->trapno == T_SYSCALL) {
-		if (proc->killed)
-			exit();
-		proc->tf = tf;
-		syscall();
-		if (proc->killed)
-			exit();
+		syscalltrap(tf);
 		return;
 	}
 
+	// Whatever woke this CPU, it's no longer halted.
+	cpu->idle = 0;
+
 	switch (tf->trapno) {
 	case T_IRQ0 + IRQ_TIMER:
 		if (cpu->id == 0) {
 			acquire(&tickslock);
-			ticks++;
-			wakeup(&ticks);
+			// The boot CPU keeps time. Once the TSC is calibrated,
+			// ticks follows it so that ticks missed while the timer
+			// was stopped are caught up.
+			if (tscfreq() == 0)
+				ticks++;
+			else if ((int)(nsecs() / NSEC_PER_TICK - ticks) > 0)
+				ticks = nsecs() / NSEC_PER_TICK;
+			if (vdsodata)
+				vdsodata->ticks = ticks;
+			twadvance();
 	    #ifdef POLL_UART
 			//hack
 			if(ticks % 100) {
@@ -54,6 +62,10 @@ void trap(struct trapframe* tf){
 		}
 		lapiceoi();
 		break;
+	case T_IRQ0 + IRQ_RESCHED:
+		// Just an interruption; the yield below does the rest.
+		lapiceoi();
+		break;
 	case T_IRQ0 + IRQ_IDE1:
 		ideintr();
 		lapiceoi();
@@ -79,11 +91,14 @@ void trap(struct trapframe* tf){
 
 	default:
 		amd64_nop(); // a label can only appear directly in front of a statement, so...
-		void (*dynamicIrqHandler)(uint16) = get_registered_handler(tf->trapno);
+		void (*dynamicIrqHandler)(uint16) = 0;
+		if(tf->trapno >= T_IRQ0) {
+			dynamicIrqHandler = get_registered_handler(tf->trapno - T_IRQ0);
+		}
 
 		if(dynamicIrqHandler) {
 			//all's good, we found a dyanmic IRQ handler that was defined for this
-			dynamicIrqHandler(tf->trapno);
+			dynamicIrqHandler(tf->trapno - T_IRQ0);
 			lapiceoi();
 		}else if (proc == 0 || (tf->cs & 3) == 0) {
 			// In kernel, it must be our mistake.
@@ -112,8 +127,15 @@ void trap(struct trapframe* tf){
 
 	// Force process to give up CPU on clock tick.
 	// If interrupts were on while locks held, would need to check nlock.
-	if (proc && proc->state == RUNNING && tf->trapno == T_IRQ0 + IRQ_TIMER)
-		yield();
+	// Skipped when nothing else is runnable.
+	if (proc && proc->state == RUNNING) {
+		if (tf->trapno == T_IRQ0 + IRQ_TIMER) {
+			if (schedtick())
+				yield();
+		} else if (tf->trapno == T_IRQ0 + IRQ_RESCHED) {
+			yield();
+		}
+	}
 
 	// Check if the process has been killed since we yielded
 	if (proc && proc->killed && (tf->cs & 3) == DPL_USER)
@@ -152,17 +152,13 @@ void vfsinit() {
 	}
 }
 
-// Lock the given inode.
+// Lock the given inode exclusively.
 // Reads the inode from disk if necessary.
 void ilock(struct inode* ip){
 	if (ip == 0 || ip->ref < 1)
 		panic("ilock");
 
-	acquire(&lock);
-	while (ip->flags & I_BUSY)
-		sleep(ip, &lock);
-	ip->flags |= I_BUSY;
-	release(&lock);
+	downwrite(&ip->lock);
 
 	if (!(ip->flags & I_VALID)) {
 		fstype t = getfstype(ip->dev);
@@ -181,6 +177,21 @@ void ilock(struct inode* ip){
 	}
 }
 
+// Lock the given inode shared, for code that only reads it,
+// so that several processes can read the same file at once.
+void ilockshared(struct inode* ip){
+	if (ip == 0 || ip->ref < 1)
+		panic("ilockshared");
+
+	// Only load the inode under the exclusive lock.
+	// It stays valid while we hold our reference.
+	if (!(ip->flags & I_VALID)) {
+		ilock(ip);
+		iunlock(ip);
+	}
+	downread(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -192,10 +203,10 @@ void iput(struct inode *ip) {
 	acquire(&lock);
 	if (ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0) {
 		// inode has no links and no other references: truncate and free.
-		if (ip->flags & I_BUSY)
+		if (rwsemlocked(&ip->lock))
 			panic("iput busy");
-		ip->flags |= I_BUSY;
 		release(&lock);
+		downwrite(&ip->lock);
 		fstype t = getfstype(ip->dev);
 		if(t == FS_TYPE_EXT2) {
 			ext2_itrunc(ip);
@@ -206,23 +217,20 @@ void iput(struct inode *ip) {
 		}
 		ip->type = 0;
 		iupdate(ip);
+		upwrite(&ip->lock);
 		acquire(&lock);
 		ip->flags = 0;
-		wakeup(ip);
 	}
 	ip->ref--;
 	release(&lock);
 }
 
-// Unlock the given inode.
+// Unlock the given inode, whether locked by ilock or ilockshared.
 void iunlock(struct inode *ip) {
-	if (ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
+	if (ip == 0 || !rwsemlocked(&ip->lock) || ip->ref < 1)
 		panic("iunlock");
 
-	acquire(&lock);
-	ip->flags &= ~I_BUSY;
-	wakeup(ip);
-	release(&lock);
+	uprw(&ip->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -294,7 +302,7 @@ static struct inode* namex(char* path, int nameiparent, char* name){
 		ip = idup(proc->cwd);
 
 	while ((path = skipelem(path, name)) != 0) {
-		ilock(ip);
+		ilockshared(ip);
 		if (ip->type != T_DIR) {
 			iunlockput(ip);
 			return 0;
@@ -331,7 +339,7 @@ int readi(struct inode *ip, char *dst, uint off, uint n) {
 		// if the read request is for a T_DEV, then route it directly there...
 		if (ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
 			return -1;
-		return devsw[ip->major].read(ip, dst, n);
+		return devsw[ip->major].read(ip, dst, off, n);
 	}
 	// otherwise, we need to route this to the correct fs impl.
 	fstype t = getfstype(ip->dev);
@@ -344,6 +352,28 @@ int readi(struct inode *ip, char *dst, uint off, uint n) {
 	}
 }
 
+// Start background reads of the blocks a sequential reader
+// of ip will want after reading n bytes at off.
+void readahead(struct inode *ip, struct readahead *ra, uint off, uint n) {
+	if (ip->type == T_DEV)
+		return;
+	if(getfstype(ip->dev) == FS_TYPE_FS1) {
+		fs1_readahead(ip, ra, off, n);
+	}
+}
+
+// Read n bytes at off straight from the disk into user memory at
+// dst, for O_DIRECT. Returns -1 if the file system or the device
+// can't, or the request isn't whole blocks; use readi() then.
+int readdirect(struct inode *ip, char *dst, uint off, uint n) {
+	if (ip->type == T_DEV)
+		return -1;
+	if(getfstype(ip->dev) == FS_TYPE_FS1) {
+		return fs1_readdirect(ip, dst, off, n);
+	}
+	return -1;
+}
+
 void stati(struct inode *ip, struct stat *st) {
 	fstype t = getfstype(ip->dev);
 	if(t == FS_TYPE_EXT2) {
@@ -372,6 +402,17 @@ int writei(struct inode *ip, char *src, uint off, uint n) {
 	}
 }
 
+// The O_DIRECT counterpart of writei(), like readdirect().
+// May write less than n; the caller continues where it stopped.
+int writedirect(struct inode *ip, char *src, uint off, uint n) {
+	if (ip->type == T_DEV)
+		return -1;
+	if(getfstype(ip->dev) == FS_TYPE_FS1) {
+		return fs1_writedirect(ip, src, off, n);
+	}
+	return -1;
+}
+
 static inline struct inode* iget(uint64 dev, uint32 inum){
 	struct inode* ip, * empty;
 
@@ -418,6 +459,7 @@ void growicache() {
         icache.head = (struct icache_node *)ptr;
         offset++;
         last = icache.head;
+        initrwsem(&last->inode.lock, "inode");
     } else {
         last = icache.head;
         while(last->next != 0) {
@@ -427,6 +469,7 @@ void growicache() {
     while(allot > offset) {
         last->next = ((struct icache_node *)ptr) + offset++;
         last = last->next;
+        initrwsem(&last->inode.lock, "inode");
     }
     icache.unused_nodes += allot;
 }
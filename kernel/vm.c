@@ -6,11 +6,13 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "vdso.h"
 #include "kernel/string.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t* kpgdir;  // for use in scheduler()
 struct segdesc gdt[NSEGS];
+struct vdso_data* vdsodata;  // shared vDSO page, see vdsoinit()
 
 
 // Return the address of the PTE in page table pgdir
@@ -100,7 +102,7 @@ int allocuvm(pde_t* pgdir, uint oldsz, uint newsz){
 	char* mem;
 	uintp a;
 
-	if (newsz >= KERNBASE)
+	if (newsz >= KERNBASE || newsz > VDSO_BASE)
 		return 0;
 	if (newsz < oldsz)
 		return oldsz;
@@ -205,6 +207,14 @@ bad:
 }
 
 
+// Map the shared vDSO page and p's own vDSO page read-only
+// at VDSO_BASE. freevm() leaves both pages alone.
+int mapvdso(pde_t* pgdir, struct proc* p){
+	if (mappages(pgdir, (char*)VDSO_BASE, PGSIZE, v2p(vdsodata), PTE_U) < 0)
+		return -1;
+	return mappages(pgdir, (char*)VDSO_PROC, PGSIZE, v2p(p->vdsoproc), PTE_U);
+}
+
 // Map user virtual address to kernel address.
 char* uva2ka(pde_t* pgdir, char* uva){
 	pte_t* pte;
@@ -43,6 +43,8 @@ static pde_t* kpgdir0;
 static pde_t* kpgdir1;
 
 void wrmsr(uint msr, uint64 val);
+uint64 rdmsr(uint msr);
+extern void syscallentry(void);
 
 void tvinit(void) {
 }
@@ -89,18 +91,28 @@ void seginit(void){
 	local = kalloc();
 	memset(local, 0, PGSIZE);
 
-	gdt = (uint64*)local;
-	tss = (uint*)(((char*)local) + 1024);
+	gdt = (uint64*)(((char*)local) + CPULOCAL_GDT);
+	tss = (uint*)(((char*)local) + CPULOCAL_TSS);
 	tss[16] = 0x00680000; // IO Map Base = End of TSS
 
 	// point FS smack in the middle of our local storage page
-	wrmsr(0xC0000100, ((uint64)local) + (PGSIZE / 2));
+	wrmsr(MSR_FSBASE, ((uint64)local) + CPULOCAL_FS);
+
+	// SYSCALL enters the kernel at syscallentry with interrupts,
+	// single-stepping and string direction flags cleared; SYSRET
+	// returns to SEG_UCODE/SEG_UDATA.
+	wrmsr(MSR_STAR, ((uint64)(((SEG_UDATA - 1) << 3) | DPL_USER) << 48) |
+	                ((uint64)(SEG_KCODE << 3) << 32));
+	wrmsr(MSR_LSTAR, (uint64)syscallentry);
+	wrmsr(MSR_FMASK, FL_IF | FL_TF | FL_DF | FL_AC);
+	wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
 
 	c = &cpus[cpunum()];
 	c->local = local;
 
 	cpu = c;
 	proc = 0;
+	percpuinit();
 
 	addr = (uint64)tss;
 	gdt[0] = 0x0000000000000000;
@@ -179,7 +191,7 @@ void switchuvm(struct proc* p){
 	pushcli();
 	if (p->pgdir == 0)
 		panic("switchuvm: no pgdir");
-	tss = (uint*)(((char*)cpu->local) + 1024);
+	tss = (uint*)(((char*)cpu->local) + CPULOCAL_TSS);
 	tss_set_rsp(tss, 0, (uintp)proc->kstack + KSTACKSIZE);
 	pml4 = (void*)PTE_ADDR(p->pgdir[511]);
 	lcr3(v2p(pml4));
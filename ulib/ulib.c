@@ -6,6 +6,10 @@
 #include "user.h"
 #include "x86.h"
 #include "console.h"
+#include "string.h"
+#include "time.h"
+#include "vdso.h"
+#include "ioring.h"
 
 //defining these k-level syscalls here for use in ioctl
 void kconsole_info(struct winsize *winsz);
@@ -65,3 +69,80 @@ char *ttyname(int32 fd){
 	}
 	return 0;
 }
+
+// The calls below are answered from the vDSO pages the kernel maps
+// into every process, without entering the kernel.
+
+int getpid(void) {
+	return ((struct vdso_proc*)VDSO_PROC)->pid;
+}
+
+int ticks(void) {
+	return ((struct vdso_data*)VDSO_BASE)->ticks;
+}
+
+int nprocs(void) {
+	return ((struct vdso_data*)VDSO_BASE)->ncpu;
+}
+
+int info(char *buf, int n) {
+	struct vdso_data *v = (struct vdso_data*)VDSO_BASE;
+	int len = strlen(v->info) + 1;
+
+	memmove(buf, v->info, n < len ? n : len);
+	return len;
+}
+
+int clock_gettime(int clockid, struct timespec *ts) {
+	struct vdso_data *v = (struct vdso_data*)VDSO_BASE;
+	uint64 ns;
+
+	if (clockid != CLOCK_MONOTONIC)
+		return -1;
+	if (v->tschz == 0)
+		ns = (uint64)v->ticks * (NSEC_PER_SEC / v->hz);
+	else
+		ns = ((unsigned __int128)(amd64_rdtsc() - v->tscboot) * v->tscmult) >> 32;
+	ts->tv_sec = ns / NSEC_PER_SEC;
+	ts->tv_nsec = ns % NSEC_PER_SEC;
+	return 0;
+}
+
+// Submission ring helpers. Queue operations with ioring_prep(), run
+// them all with one ioring_submit(), then collect the results with
+// ioring_reap().
+
+void ioring_init(struct ioring *r) {
+	memset(r, 0, sizeof(*r));
+}
+
+// Queue one operation; returns -1 if the submission queue is full.
+int ioring_prep(struct ioring *r, int op, int fd, void *addr, int len, uint64 udata) {
+	struct io_sqe *sqe;
+
+	if (r->sqtail - r->sqhead >= IORING_ENTRIES)
+		return -1;
+	sqe = &r->sq[r->sqtail & (IORING_ENTRIES - 1)];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->op = op;
+	sqe->fd = fd;
+	sqe->addr = (uint64)addr;
+	sqe->len = len;
+	sqe->udata = udata;
+	r->sqtail++;
+	return 0;
+}
+
+// Run everything queued; returns the number of entries consumed.
+int ioring_submit(struct ioring *r) {
+	return ioring_enter(r, r->sqtail - r->sqhead);
+}
+
+// Copy out the oldest completion; returns 0 if there is none.
+int ioring_reap(struct ioring *r, struct io_cqe *cqe) {
+	if (r->cqhead == r->cqtail)
+		return 0;
+	*cqe = r->cq[r->cqhead & (IORING_ENTRIES - 1)];
+	r->cqhead++;
+	return 1;
+}
@@ -0,0 +1,67 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "string.h"
+#include "fcntl.h"
+#include "file.h"
+#include "param.h"
+#include "lockstat.h"
+
+// Print the most contended spinlocks, with the call stack of their
+// latest contended acquire. Pipe the output to tools/desymbolicate
+// to turn the addresses into function names.
+// usage: lockstat [count]
+
+struct lockstat stats[NLOCKSTAT];
+struct lockstat buf[32];
+
+int main(int argc, char *argv[]) {
+	struct lockstat *t;
+	int fd, n, r, i, j, top;
+
+	top = argc > 1 ? atoi(argv[1]) : 10;
+	if((fd = open("/dev/lockstat", O_RDONLY)) < 0) {
+		mknod("/dev/lockstat", LOCKSTAT, 0);
+		fd = open("/dev/lockstat", O_RDONLY);
+	}
+	if(fd < 0) {
+		fprintf(stderr, "lockstat: cannot open /dev/lockstat\n");
+		procexit();
+	}
+
+	// Keep the NLOCKSTAT most contended, most contended first.
+	n = 0;
+	while((r = read(fd, buf, sizeof(buf))) > 0) {
+		for(t = buf; t < buf + r / sizeof(struct lockstat); t++) {
+			if(n == NLOCKSTAT && stats[n-1].contended >= t->contended)
+				continue;
+			if(n < NLOCKSTAT)
+				n++;
+			for(j = n - 1; j > 0 && stats[j-1].contended < t->contended; j--)
+				stats[j] = stats[j-1];
+			stats[j] = *t;
+		}
+	}
+	if(r < 0) {
+		fprintf(stderr, "lockstat: cannot read /dev/lockstat\n");
+		procexit();
+	}
+	close(fd);
+	if(n == 0) {
+		fprintf(stderr, "lockstat: no statistics; build the kernel with LOCK_STATS\n");
+		procexit();
+	}
+
+	fprintf(stdout, "NAME\tACQUIRED\tCONTENDED\tAVG SPIN\tMAX SPIN\tAVG HOLD\n");
+	for(i = 0; i < n && i < top; i++) {
+		struct lockstat *ls = &stats[i];
+		fprintf(stdout, "%s\t%d\t%d\t%d\t%d\t%d\n", ls->name,
+		        (int)ls->acquired, (int)ls->contended,
+		        ls->contended ? (int)(ls->spincycles / ls->contended) : 0,
+		        (int)ls->maxspin,
+		        ls->acquired ? (int)(ls->holdcycles / ls->acquired) : 0);
+		for(j = 0; j < LOCKSTAT_NPCS && ls->pcs[j]; j++)
+			fprintf(stdout, " [%d] ffffffff%x\n", j, (uint)ls->pcs[j]);
+	}
+	procexit();
+}
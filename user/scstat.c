@@ -0,0 +1,89 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "string.h"
+#include "fcntl.h"
+#include "file.h"
+#include "syscall.h"
+#include "scstat.h"
+
+// Print per system call counts and latency histograms.
+// scstat -h adds the histogram of every call made.
+
+char *names[SCSTAT_NSYS] = {
+	[SYS_fork] "fork",
+	[SYS_procexit] "procexit",
+	[SYS_wait] "wait",
+	[SYS_pipe] "pipe",
+	[SYS_read] "read",
+	[SYS_kill] "kill",
+	[SYS_exec] "exec",
+	[SYS_fstat] "fstat",
+	[SYS_chdir] "chdir",
+	[SYS_dup] "dup",
+	[SYS_getpid] "getpid",
+	[SYS_sbrk] "sbrk",
+	[SYS_sleep] "sleep",
+	[SYS_amblessed] "amblessed",
+	[SYS_open] "open",
+	[SYS_write] "write",
+	[SYS_mknod] "mknod",
+	[SYS_unlink] "unlink",
+	[SYS_link] "link",
+	[SYS_mkdir] "mkdir",
+	[SYS_close] "close",
+	[SYS_reboot] "reboot",
+	[SYS_kconsole_info] "kconsole_info",
+	[SYS_seek] "seek",
+	[SYS_getppid] "getppid",
+	[SYS_bless] "bless",
+	[SYS_damn] "damn",
+	[SYS_isblessed] "isblessed",
+	[SYS_bfork] "bfork",
+	[SYS_mkvdev] "mkvdev",
+	[SYS_pstate] "pstate",
+	[SYS_pname] "pname",
+	[SYS_ticks] "ticks",
+	[SYS_halt] "halt",
+	[SYS_info] "info",
+	[SYS_nprocs] "nprocs",
+	[SYS_cpuhalt] "cpuhalt",
+	[SYS_getpriority] "getpriority",
+	[SYS_setpriority] "setpriority",
+	[SYS_getscheduler] "getscheduler",
+	[SYS_setscheduler] "setscheduler",
+	[SYS_clock_gettime] "clock_gettime",
+	[SYS_nanosleep] "nanosleep",
+	[SYS_ioring_enter] "ioring_enter",
+};
+
+struct scstat stats[SCSTAT_NSYS];
+
+int main(int argc, char *argv[]) {
+	int fd, n, num, b;
+	int hist = argc > 1 && strncmp(argv[1], "-h", 3) == 0;
+
+	if((fd = open("/dev/scstat", O_RDONLY)) < 0) {
+		mknod("/dev/scstat", SCSTAT, 0);
+		fd = open("/dev/scstat", O_RDONLY);
+	}
+	if(fd < 0 || (n = read(fd, stats, sizeof(stats))) < 0) {
+		fprintf(stderr, "scstat: cannot read /dev/scstat\n");
+		procexit();
+	}
+	close(fd);
+
+	fprintf(stdout, "NUM\tNAME\tCALLS\tAVG CYCLES\n");
+	for(num = 0; num < n / sizeof(struct scstat); num++) {
+		if(stats[num].count == 0)
+			continue;
+		fprintf(stdout, "%d\t%s\t%d\t%d\n", num, names[num] ? names[num] : "?",
+		        (int)stats[num].count, (int)(stats[num].cycles / stats[num].count));
+		if(!hist)
+			continue;
+		for(b = 0; b < SCSTAT_BUCKETS; b++)
+			if(stats[num].hist[b])
+				fprintf(stdout, "\t  2^%d\t%d\n", b, stats[num].hist[b]);
+	}
+	procexit();
+}